@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Layout.h"
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <optional>
+
+namespace classgraph {
+    /**
+     * Wall-clock budget for a search. expired() is checked around every cheap swap, so it only reads the clock every
+     * few calls; checks guarding a full evaluation or more use expired_now().
+     */
+    class Deadline {
+        static constexpr uint32_t CLOCK_EVERY = 64;
+
+        std::optional<std::chrono::steady_clock::time_point> at{};
+        mutable uint32_t checks = 0;
+        mutable bool passed = false;
+
+    public:
+        // Never expires
+        Deadline() = default;
+
+        static Deadline after(std::chrono::milliseconds budget) {
+            Deadline deadline;
+            deadline.at = std::chrono::steady_clock::now() + budget;
+            return deadline;
+        }
+
+        bool expired() const {
+            if (!at || passed) {
+                return passed;
+            }
+
+            if (++checks % CLOCK_EVERY == 0) {
+                passed = std::chrono::steady_clock::now() >= *at;
+            }
+            return passed;
+        }
+
+        bool expired_now() const {
+            if (at && !passed) {
+                passed = std::chrono::steady_clock::now() >= *at;
+            }
+            return passed;
+        }
+    };
+
+    /**
+     * Periodically hands the best layout so far to a writer, every interval or when SIGUSR1 was received (see
+     * install_checkpoint_signal)
+     */
+    class Checkpointer {
+        std::function<void(const Layout&)> write;
+        std::chrono::milliseconds interval;
+        std::chrono::steady_clock::time_point last_written;
+        // SIGUSR1 requests answered by this Checkpointer, so each one sees every request
+        std::sig_atomic_t handled_requests;
+
+    public:
+        Checkpointer(std::function<void(const Layout&)> write, std::chrono::milliseconds interval);
+
+        // Whether a checkpoint should be written now
+        bool due() const;
+
+        void checkpoint(const Layout& best);
+
+        void offer(const Layout& best) {
+            if (due()) {
+                checkpoint(best);
+            }
+        }
+    };
+
+    // Make SIGUSR1 request a checkpoint from every Checkpointer
+    void install_checkpoint_signal();
+}
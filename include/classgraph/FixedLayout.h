@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Layout.h"
+#include "Swaps.h"
+#include <array>
+
+namespace classgraph {
+    /**
+     * Layout and evaluator specialized for at most MaxTerms terms of at most MaxPositions classes, all of whose
+     * connexions join adjacent terms (for instance after Layout::with_waypoints). Crossings come from a
+     * BasicCrossingBitsets of the same bucket, so a swap is evaluated from the two classes involved instead of every
+     * pair of connexions; this adds the class at each position and edge lengths.
+     */
+    template <int MaxTerms, int MaxPositions>
+    class FixedLayout {
+        using Bitsets = BasicCrossingBitsets<MaxTerms, MaxPositions>;
+        using Row = typename Bitsets::Row;
+
+        Bitsets bitsets;
+        // Class at each position
+        std::array<std::array<ClassID, MaxPositions>, MaxTerms> classes{};
+
+        // Total length of the edges from position pos to the positions in row
+        static int row_length(const Row& row, int pos) {
+            int length = 0;
+            for (int w = 0; w < static_cast<int>(row.size()); ++w) {
+                for (uint64_t bits = row[w]; bits; bits &= bits - 1) {
+                    length += std::abs(64 * w + __builtin_ctzll(bits) - pos);
+                }
+            }
+            return length;
+        }
+
+        // Change in edge length if the class at from moved to to
+        int move_length_delta(int term, int from, int to) const {
+            const Row& n = bitsets.next_row(term, from);
+            const Row& p = bitsets.prev_row(term, from);
+            return row_length(n, to) - row_length(n, from) + row_length(p, to) - row_length(p, from);
+        }
+
+    public:
+        // Whether layout fits the bucket and has only connexions between adjacent terms
+        static bool fits(const Layout& layout) {
+            if (!Bitsets::fits(layout)) {
+                return false;
+            }
+
+            bool adjacent = true;
+            layout.for_each_connexion([&] (const Connexion& c) {
+                adjacent &= std::abs(c.pt1.x - c.pt2.x) == 1;
+            });
+
+            return adjacent;
+        }
+
+        explicit FixedLayout(const Layout& layout) : bitsets(layout) {
+            assert(fits(layout));
+
+            layout.for_each_term([&] (const auto& term, int term_i) {
+                for (ClassID id : term) {
+                    classes[term_i][layout.get_class(id).order] = id;
+                }
+            });
+        }
+
+        int term_size(int term) const {
+            return bitsets.term_size(term);
+        }
+
+        // Same as Layout::evaluate. Connexions between adjacent terms touch exactly when they cross properly
+        ObjectiveValue evaluate() const {
+            int crossings = bitsets.count(), length = 0;
+            for (int t = 0; t < MaxTerms; ++t) {
+                for (int p = 0; p < term_size(t); ++p) {
+                    length += row_length(bitsets.next_row(t, p), p);
+                }
+            }
+
+            return { { crossings, crossings }, length };
+        }
+
+        // Change in evaluate() if positions i and j of the term were swapped
+        ObjectiveValue swap_delta(int term, int i, int j) const {
+            if (i > j) {
+                std::swap(i, j);
+            }
+
+            int crossings = bitsets.swap_delta(term, i, j);
+            int length = move_length_delta(term, i, j) + move_length_delta(term, j, i);
+
+            return { { crossings, crossings }, length };
+        }
+
+        void swap(int term, int i, int j) {
+            std::swap(classes[term][i], classes[term][j]);
+            bitsets.swap(term, i, j);
+        }
+
+        // Copy the order of every term into layout, which must be the one this was made from
+        void write_orders(Layout& layout) const {
+            for (int t = 0; t < static_cast<int>(layout.term_count()); ++t) {
+                layout.set_term_order(t, std::vector<ClassID>(classes[t].begin(), classes[t].begin() + term_size(t)));
+            }
+            layout.compute_possible_intersections();
+        }
+    };
+
+    /**
+     * Call fn with a FixedLayout of the smallest bucket layout fits in. Returns false, without calling fn, if it fits
+     * none of them.
+     */
+    template <typename Fn>
+    bool with_fixed_layout(const Layout& layout, Fn&& fn) {
+        // Four-year plans, then anything up to the term limit
+        if (FixedLayout<8, 32>::fits(layout)) {
+            FixedLayout<8, 32> fixed { layout };
+            fn(fixed);
+            return true;
+        }
+
+        if (FixedLayout<MAX_TERMS, 64>::fits(layout)) {
+            FixedLayout<MAX_TERMS, 64> fixed { layout };
+            fn(fixed);
+            return true;
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Swaps.h"
+#include <ostream>
+#include <string>
+
+namespace classgraph {
+    /**
+     * Time each kernel variant the build has on this machine over a range of input sizes, and pick the size from
+     * which each one is faster than the narrower ones. Takes a few tens of milliseconds. parallel_count_min keeps
+     * its default, since it depends on the load of the machine more than on the kernels.
+     */
+    KernelTuning calibrate_kernels();
+
+    // Plain "key value" lines, so a calibration can be reused across runs on the same machine
+    void save_kernel_tuning(const KernelTuning& tuning, const std::string& filename);
+    // Returns false if the file can't be read; unknown keys are ignored and missing keys keep their value in tuning
+    bool load_kernel_tuning(KernelTuning& tuning, const std::string& filename);
+
+    std::ostream& operator<<(std::ostream& out, const KernelTuning& tuning);
+}
@@ -6,7 +6,11 @@
 
 #include <istream>
 #include <array>
+#include <bitset>
 #include <vector>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <cassert>
 
 namespace classgraph {
@@ -56,6 +60,24 @@ namespace classgraph {
         Connexion c2;
     };
 
+    // Same as an Intersection, but naming the classes at each point instead of their positions
+    struct IndexedIntersection {
+        ClassID a;
+        ClassID b;
+        ClassID c;
+        ClassID d;
+    };
+
+    // Position of each class ID, for looking up the points of an IndexedIntersection
+    using PositionTable = std::array<SmallPoint, NO_CLASS_ID + 1>;
+
+    enum class IntersectionStorage {
+        // Intersections hold the points themselves, so a swap rewrites every matching point
+        Points,
+        // Intersections hold class IDs, so a swap only touches the position table
+        ClassIDs
+    };
+
     struct Node {
         int8_t term;
         uint8_t order{};
@@ -84,6 +106,18 @@ namespace classgraph {
         }
     };
 
+    struct IntersectionCounters;
+    struct ObjectiveValue;
+
+    // Malformed input to Layout::parse, naming the line it was found on
+    class LayoutParseError : public std::runtime_error {
+    public:
+        LayoutParseError(const std::string& message, size_t line)
+            : std::runtime_error("line " + std::to_string(line) + ": " + message), line(line) {}
+
+        size_t line;
+    };
+
     using NodeInfo = std::array<Node, MAX_CLASS_ID>;
     using Terms = std::vector<std::vector<uint8_t>>;
 
@@ -92,8 +126,17 @@ namespace classgraph {
         Terms terms{};
 
         std::vector<Connexion> resolved_connexions{};
+        // (prereq, class) of each resolved connexion
+        std::vector<std::pair<ClassID, ClassID>> resolved_ends{};
         std::vector<Intersection> possible_intersections{};
 
+        // Virtual nodes added by with_waypoints
+        std::bitset<NO_CLASS_ID + 1> waypoints{};
+
+        IntersectionStorage storage = IntersectionStorage::Points;
+        std::vector<IndexedIntersection> indexed_intersections{};
+        PositionTable positions{};
+
     public:
         Layout() = delete;
         Layout(const NodeInfo& info, Terms&& terms);
@@ -107,9 +150,20 @@ namespace classgraph {
             }
         }
 
+        /**
+         * Calls callback with one Connexion per (prereq, class) edge. pt1 is the prereq, pt2 the class requiring it.
+         * Prereqs which aren't part of the layout are skipped.
+         */
         template <typename Lambda>
         void for_each_connexion(Lambda callback) const {
-
+            for_each_class([&] (const Node& node) {
+                node.for_each_prereq([&] (ClassID prereq) {
+                    const auto& source = node_info.at(prereq);
+                    if (source.class_id != NO_CLASS_ID) {
+                        callback(Connexion { source.small_point(), node.small_point() });
+                    }
+                });
+            });
         }
 
         template <typename Lambda>
@@ -117,9 +171,68 @@ namespace classgraph {
             int i = 0;
             for (const auto& term : terms) {
                 callback(term, i);
+                i++;
             }
         }
 
+        size_t term_count() const {
+            return terms.size();
+        }
+
+        const Terms& get_terms() const {
+            return terms;
+        }
+
+        const std::vector<Intersection>& get_possible_intersections() const {
+            return possible_intersections;
+        }
+
+        const std::vector<IndexedIntersection>& get_indexed_intersections() const {
+            return indexed_intersections;
+        }
+
+        // (prereq, class) of each connexion
+        const std::vector<std::pair<ClassID, ClassID>>& get_connexion_ends() const {
+            return resolved_ends;
+        }
+
+        // Only kept up to date with IntersectionStorage::ClassIDs
+        const PositionTable& get_positions() const {
+            return positions;
+        }
+
+        IntersectionStorage get_intersection_storage() const {
+            return storage;
+        }
+
+        // Switch representation of the possible intersections, recomputing them
+        void set_intersection_storage(IntersectionStorage new_storage);
+
+        bool has_class(ClassID classID) const {
+            return classID < node_info.size() && node_info[classID].class_id != NO_CLASS_ID;
+        }
+
+        // Whether classID is a virtual node added by with_waypoints rather than a class
+        bool is_waypoint(ClassID classID) const {
+            return waypoints.test(classID);
+        }
+
+        /**
+         * Copy of the layout where each prereq edge spanning several terms runs through a virtual waypoint node in
+         * every term it passes, so all connexions join adjacent terms and can be routed by the optimizers. Waypoints
+         * take unused class IDs and start at the order interpolated between the ends of their edge. Throws
+         * std::length_error if there aren't enough unused class IDs.
+         */
+        Layout with_waypoints() const;
+        // Drop the waypoints, reconnecting each class to its original prereqs and keeping the order of the rest
+        Layout without_waypoints() const;
+
+        // Class IDs of the given term, sorted by their current order
+        std::vector<ClassID> ordered_term(int term) const;
+
+        // Assign orders 0, 1, ... to the classes in the given term. Call compute_possible_intersections afterwards.
+        void set_term_order(int term, const std::vector<ClassID>& order);
+
         void swap_nodes(Node& a, Node& b);
 
         const Node& get_class(ClassID classID) const {
@@ -134,15 +247,45 @@ namespace classgraph {
             return node;
         }
 
+        /**
+         * Parse the plain-text format: the term count, then for each term its index and class count, followed by
+         * each class as its ID, prereq count and prereq IDs, all separated by whitespace. Throws LayoutParseError.
+         */
+        static Layout parse(std::string_view text);
+        // Buffers the whole stream, then parses it
         static Layout read(std::istream& in);
+        // Parses the file in place through a memory map where available
+        static Layout read_file(const std::string& filename);
+
+        /**
+         * Same as parse, read and read_file, but into this layout, reusing its buffers. A worker loading many
+         * layouts in turn allocates next to nothing once its buffers have grown. If parsing throws, the layout must
+         * be reloaded before further use.
+         */
+        void reload(std::string_view text);
+        void reload(std::istream& in);
+        void reload_file(const std::string& filename);
 
         void shuffle();
+        // Shuffle a single term without updating the possible intersections
+        void shuffle_term(int term);
 
         bool is_compatible_with(const Layout& other) const;
 
         void compute_connexions();
         void compute_possible_intersections();
 
+        IntersectionCounters count_crossings() const;
+        // Sum of |difference in order| over all connexions
+        int edge_length() const;
+        // Crossings and edge length together
+        ObjectiveValue evaluate() const;
+
+        // Classes grouped by connectedness through prereqs, each group sorted by class ID
+        std::vector<std::vector<ClassID>> connected_components() const;
+        // Layout of only the given classes, keeping their terms and relative order
+        Layout sub_layout(const std::vector<ClassID>& classes) const;
+
         friend class LayoutIO;
     };
 }
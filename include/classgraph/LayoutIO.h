@@ -2,20 +2,45 @@
 
 #include <nlohmann/json.hpp>
 #include <optional>
+#include <string>
+#include <vector>
 #include "Layout.h"
 
 namespace classgraph {
     class LayoutIO {
-        std::optional<nlohmann::json> json{};
+        // Byte range [begin, end) of a value in source
+        struct Span {
+            size_t begin;
+            size_t end;
+        };
+
+        // The input as read, and where each term's curriculum_items elements are in it
+        std::string source{};
+        std::vector<std::vector<Span>> item_spans{};
+
         std::optional<Layout> read_layout{};
+
+        // Buffers of the input before the current one, which the next read parses into
+        std::string next_source{};
+        std::vector<std::vector<Span>> next_item_spans{};
+        std::optional<Layout> next_layout{};
+
     public:
+        // Reading again reuses the buffers of earlier inputs, so one LayoutIO can load many files in turn. Invalid
+        // input throws std::runtime_error and leaves the previous input and layout untouched.
         void read_json(std::istream &in);
+        // Also throws std::runtime_error if the file can't be opened
         void read_json(const std::string& filename);
 
         void write_layout_to_canvas(const Layout& compatible, std::ostream& out) const;
 
+        // Copy the input to out, with the items of each term in the order of compatible. No DOM is built; the
+        // input bytes are streamed out with the item spans spliced in their new order.
         void write_new_layout(const Layout& compatible, std::ostream& out) const;
         void write_new_layout(const Layout& compatible, const std::string& filename) const;
+        // Write to a temporary file next to filename, then rename it over filename, so readers never see a partial file.
+        // Returns false, leaving filename untouched and removing the temporary file, if any step fails.
+        bool write_new_layout_atomically(const Layout& compatible, const std::string& filename) const;
 
         size_t term_count() const;
 
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Layout.h"
+#include "Swaps.h"
+#include "Anytime.h"
+#include <vector>
+#include <optional>
+
+namespace classgraph {
+    struct Objective {
+        enum class Mode {
+            // Fewer proper crossings, then improper crossings, then shorter edges
+            Lexicographic,
+            // Weighted sum of the three
+            Weighted
+        };
+
+        Mode mode = Mode::Lexicographic;
+
+        double proper_weight = 1;
+        double improper_weight = 0.25;
+        double length_weight = 0.05;
+
+        double cost(const ObjectiveValue& value) const {
+            return proper_weight * value.crossings.proper + improper_weight * value.crossings.improper
+                + length_weight * value.edge_length;
+        }
+
+        // Whether a is strictly better than b. Linear, so it also compares deltas
+        bool better(const ObjectiveValue& a, const ObjectiveValue& b) const {
+            if (mode == Mode::Weighted) {
+                return cost(a) < cost(b);
+            }
+
+            if (a.crossings == b.crossings) {
+                return a.edge_length < b.edge_length;
+            }
+
+            return a.crossings < b.crossings;
+        }
+    };
+
+    struct OptimizerOptions {
+        // Number of shuffled restarts after the initial order has been searched
+        int restarts = 16;
+        // Maximum number of passes over all swaps in a single local search
+        int max_passes = 64;
+        // Terms which may be reordered, or all of them if unset
+        std::optional<std::vector<int>> active_terms{};
+        // Representation of the possible intersections while searching
+        IntersectionStorage storage = IntersectionStorage::Points;
+        Objective objective{};
+        // Search layouts which fit a FixedLayout bucket with it, evaluating swaps by their delta
+        bool fixed_buckets = true;
+
+        // The best layout found is returned once this expires
+        Deadline deadline{};
+        // Receives the best layout so far during long searches. Not owned
+        Checkpointer* checkpointer = nullptr;
+    };
+
+    /**
+     * Random-restart local search over swaps of two classes in the same term. The first search starts from the
+     * initial order, so a warm-started layout is only ever improved upon.
+     */
+    class Optimizer {
+        OptimizerOptions options;
+
+        Layout best;
+        ObjectiveValue best_value{};
+
+        std::vector<int> searched_terms() const;
+        ObjectiveValue local_search(Layout& layout, const std::vector<int>& terms) const;
+
+        bool checkpoint_due() const;
+        // Checkpoint current, at value, if it beats the best so far, or else the best
+        void checkpoint(const Layout& current, ObjectiveValue value) const;
+
+    public:
+        explicit Optimizer(const Layout& initial, OptimizerOptions options = {});
+
+        const Layout& optimize();
+
+        const Layout& get_best() const {
+            return best;
+        }
+
+        IntersectionCounters get_best_score() const {
+            return best_value.crossings;
+        }
+
+        ObjectiveValue get_best_value() const {
+            return best_value;
+        }
+    };
+
+    /**
+     * Optimize each connected component of the layout on its own, in parallel, then stack the components in every
+     * term, in the order which crosses the fewest connexions between them. Classes without any connexions are kept
+     * together as one component.
+     */
+    Layout optimize_components(const Layout& layout, const OptimizerOptions& options = {});
+
+    /**
+     * Carry the order of a previously optimized layout over to an edited version of it. Classes which stayed in
+     * their term keep their previous relative order, and new or moved classes are inserted at the position with the
+     * fewest crossings. Returns the terms whose classes or connexions changed, which are the only ones worth
+     * searching again.
+     */
+    std::vector<int> warm_start(Layout& edited, const Layout& previous);
+}
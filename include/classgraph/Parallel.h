@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Swaps.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace classgraph {
+    /**
+     * Fixed set of threads kept alive between jobs, so splitting a scan across cores doesn't pay for thread
+     * creation every time. The calling thread takes part as worker 0.
+     */
+    class WorkerPool {
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        const std::function<void(unsigned)>* job = nullptr;
+        uint64_t generation = 0;
+        unsigned pending = 0;
+        bool stopping = false;
+
+        // Held for the duration of a job; one job runs at a time
+        std::mutex running;
+
+        void work(unsigned worker);
+
+    public:
+        explicit WorkerPool(unsigned workers = std::max(1u, std::thread::hardware_concurrency()));
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        // Number of workers, including the calling thread
+        unsigned size() const {
+            return static_cast<unsigned>(threads.size()) + 1;
+        }
+
+        /**
+         * Call job(worker) once on every worker and return when all calls are done. If the pool is already running
+         * a job (another thread, or a nested call) only job(0) is called, on the calling thread, so jobs must share
+         * their work through a queue rather than split it by worker index.
+         */
+        void run(const std::function<void(unsigned)>& job);
+
+        // Pool with one worker per hardware thread, started on first use
+        static WorkerPool& shared();
+    };
+
+    /**
+     * Same as count_intersections, split into cache-sized chunks starting on 64-byte boundaries which the pool's
+     * workers take in turn. Inputs smaller than kernel_tuning.parallel_count_min are counted on the calling thread.
+     * A null pool means WorkerPool::shared(), which is only started once an input reaches that size.
+     */
+    IntersectionCounters count_intersections_parallel(const uint64_t* begin, const uint64_t* end,
+                                                      WorkerPool* pool = nullptr);
+
+    inline IntersectionCounters count_intersections_parallel(const std::vector<Intersection>& inter,
+                                                             WorkerPool* pool = nullptr) {
+        return count_intersections_parallel((const uint64_t*)inter.data(), (const uint64_t*)(inter.data() + inter.size()), pool);
+    }
+}
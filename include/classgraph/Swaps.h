@@ -3,7 +3,7 @@
 #include "Layout.h"
 #include <vector>
 
-#ifdef __AVX2__
+#if defined(__AVX2__) || defined(__BMI2__)
 #include <immintrin.h>
 #endif
 
@@ -13,83 +13,125 @@
 
 #include <tuple>
 #include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
 
 namespace classgraph {
     /**
-     * Rapidly swap u16 values in the range [begin, end]
+     * Smallest number of elements per call from which each native kernel variant is used. The defaults are
+     * hand-picked; calibrate_kernels (KernelTuning.h) measures them for the host.
      */
-    template<bool UseNative=true>
-    void swap_small_points(uint16_t* begin, const uint16_t* end, uint16_t a, uint16_t b) {
+    struct KernelTuning {
+        // swap_small_points, in u16 elements
+        size_t swap_512_min = 64;
 #if defined(__AVX512VL__) && defined(__AVX512BW__)
-        if constexpr (UseNative) {
-            if (end - begin >= 64) {  // only faster above a certain threshold
-                __m512i splat_a = _mm512_set1_epi16(a), splat_b = _mm512_set1_epi16(b);
+        size_t swap_256_min = SIZE_MAX;
+#else
+        size_t swap_256_min = 0;
+#endif
+        // count_intersections, in intersections
+        size_t count_512_min = 0;
+        // count_intersections_parallel, in intersections; below this the workers cost more than they save
+        size_t parallel_count_min = 1 << 18;
+    };
 
-                auto do_with_mask = [&] (int mask_shift) {
-                    __mmask32 mask = mask_shift >= 32 ? -1 : (((uint32_t)1 << mask_shift) - 1);
-                    __m512i load = _mm512_maskz_loadu_epi16(mask, (const __m512i*) begin);
+    inline KernelTuning kernel_tuning{};
 
-                    __mmask32 matches_a = _mm512_cmpeq_epi16_mask(load, splat_a);
-                    __mmask32 matches_b = _mm512_cmpeq_epi16_mask(load, splat_b);
+    inline void swap_small_points_scalar(uint16_t* begin, const uint16_t* end, uint16_t a, uint16_t b) {
+        while (begin < end) {
+            uint16_t val = *begin;
 
-                    __m512i a_swap = _mm512_mask_mov_epi16(load, matches_a, splat_b);
-                    __m512i result = _mm512_mask_mov_epi16(a_swap, matches_b, splat_a);
+            if (val == a) {
+                val = b;
+            } else if (val == b) {
+                val = a;
+            }
 
-                    _mm512_mask_storeu_epi16((void*) begin, mask, result);
-                };
+            *(unsigned short*)begin = val;
+            begin++;
+        }
+    }
 
-                // Align me to 64-byte boundary
-                int rem = (uintptr_t)begin % 64;
-                if (rem != 0) {
-                    rem = 32 - (rem >> 1);
-                    do_with_mask(rem);
-                    begin += rem;
-                }
+#if defined(__AVX512VL__) && defined(__AVX512BW__)
+    inline void swap_small_points_avx512(uint16_t* begin, const uint16_t* end, uint16_t a, uint16_t b) {
+        __m512i splat_a = _mm512_set1_epi16(a), splat_b = _mm512_set1_epi16(b);
 
-                while (begin < end) {
-                    ptrdiff_t mask_shift = end - begin;
-                    do_with_mask(mask_shift);
-                    begin += 32;
-                }
+        auto do_with_mask = [&] (ptrdiff_t mask_shift) {
+            __mmask32 mask = mask_shift >= 32 ? -1 : (((uint32_t)1 << mask_shift) - 1);
+            __m512i load = _mm512_maskz_loadu_epi16(mask, (const __m512i*) begin);
 
-                return;
-            }
+            __mmask32 matches_a = _mm512_cmpeq_epi16_mask(load, splat_a);
+            __mmask32 matches_b = _mm512_cmpeq_epi16_mask(load, splat_b);
+
+            __m512i a_swap = _mm512_mask_mov_epi16(load, matches_a, splat_b);
+            __m512i result = _mm512_mask_mov_epi16(a_swap, matches_b, splat_a);
+
+            _mm512_mask_storeu_epi16((void*) begin, mask, result);
+        };
+
+        // Align me to 64-byte boundary
+        int rem = (uintptr_t)begin % 64;
+        if (rem != 0) {
+            rem = 32 - (rem >> 1);
+            do_with_mask(std::min<ptrdiff_t>(rem, end - begin));  // short inputs may end before the boundary
+            begin += rem;
         }
 
-#elif defined(__AVX2__)
-        if constexpr (UseNative) {
-#define ITER(prefix, si, vtype, stride) {\
-                vtype splat_a = prefix##_set1_epi16(a), splat_b = prefix##_set1_epi16(b); \
-                while (begin + stride - 1 < end) { \
-                    vtype load = prefix##_loadu_##si((const vtype*) begin); \
-                    vtype matches_a = prefix##_cmpeq_epi16(load, splat_a); \
-                    vtype matches_b = prefix##_cmpeq_epi16(load, splat_b); \
-                    vtype result = prefix##_blendv_epi8(load, splat_b, matches_a); \
-                    result = prefix##_blendv_epi8(result, splat_a,  matches_b); \
-                    prefix##_storeu_##si((vtype*) begin, result); \
-                    begin += stride; \
-                }\
-            }
+        while (begin < end) {
+            ptrdiff_t mask_shift = end - begin;
+            do_with_mask(mask_shift);
+            begin += 32;
+        }
+    }
+#endif
 
-            ITER(_mm256, si256, __m256i, 16)
-            ITER(_mm, si128, __m128i, 8)
+#ifdef __AVX2__
+    inline void swap_small_points_avx2(uint16_t* begin, const uint16_t* end, uint16_t a, uint16_t b) {
+#define ITER(prefix, si, vtype, stride) {\
+            vtype splat_a = prefix##_set1_epi16(a), splat_b = prefix##_set1_epi16(b); \
+            while (begin + stride - 1 < end) { \
+                vtype load = prefix##_loadu_##si((const vtype*) begin); \
+                vtype matches_a = prefix##_cmpeq_epi16(load, splat_a); \
+                vtype matches_b = prefix##_cmpeq_epi16(load, splat_b); \
+                vtype result = prefix##_blendv_epi8(load, splat_b, matches_a); \
+                result = prefix##_blendv_epi8(result, splat_a,  matches_b); \
+                prefix##_storeu_##si((vtype*) begin, result); \
+                begin += stride; \
+            }\
         }
+
+        ITER(_mm256, si256, __m256i, 16)
+        ITER(_mm, si128, __m128i, 8)
 #undef ITER
+
+        swap_small_points_scalar(begin, end, a, b);
+    }
 #endif
 
-        // clean up
-        while (begin < end) {
-            uint16_t val = *begin;
+    /**
+     * Rapidly swap u16 values in the range [begin, end], with the widest kernel worth it for the size
+     */
+    template<bool UseNative=true>
+    void swap_small_points(uint16_t* begin, const uint16_t* end, uint16_t a, uint16_t b) {
+        if constexpr (UseNative) {
+            [[maybe_unused]] size_t size = end - begin;
 
-            if (val == a) {
-                val = b;
-            } else if (val == b) {
-                val = a;
+#if defined(__AVX512VL__) && defined(__AVX512BW__)
+            if (size >= kernel_tuning.swap_512_min) {
+                swap_small_points_avx512(begin, end, a, b);
+                return;
             }
-
-            *(unsigned short*)begin = val;
-            begin++;
+#endif
+#ifdef __AVX2__
+            if (size >= kernel_tuning.swap_256_min) {
+                swap_small_points_avx2(begin, end, a, b);
+                return;
+            }
+#endif
         }
+
+        swap_small_points_scalar(begin, end, a, b);
     }
 
     // Swap pairs (r, swap_i) and (r, swap_j) where row_min <= r <= row_max
@@ -119,8 +161,8 @@ namespace classgraph {
 
     template <bool UseNative=true, typename T>
     std::enable_if_t<sizeof(T) % 2 == 0> swap_small_points_vector(std::vector<T>& vec, uint16_t a, uint16_t b) {
-        swap_small_points<UseNative>(reinterpret_cast<uint16_t*>(&*vec.begin()),
-                          reinterpret_cast<uint16_t*>(&*vec.end()),
+        swap_small_points<UseNative>(reinterpret_cast<uint16_t*>(vec.data()),
+                          reinterpret_cast<uint16_t*>(vec.data() + vec.size()),
                           a, b);
     }
 
@@ -141,6 +183,19 @@ namespace classgraph {
         bool operator== (const IntersectionCounters& other) const {
             return proper == other.proper && improper == other.improper;
         }
+
+        IntersectionCounters operator+ (const IntersectionCounters& other) const {
+            return { proper + other.proper, improper + other.improper };
+        }
+
+        IntersectionCounters operator- (const IntersectionCounters& other) const {
+            return { proper - other.proper, improper - other.improper };
+        }
+
+        // Fewer proper intersections is better; improper intersections break ties
+        bool operator< (const IntersectionCounters& other) const {
+            return proper < other.proper || (proper == other.proper && improper < other.improper);
+        }
     };
 
 
@@ -149,6 +204,69 @@ namespace classgraph {
         return out;
     }
 
+    struct ObjectiveValue {
+        IntersectionCounters crossings{};
+        int edge_length{};
+
+        ObjectiveValue operator+ (const ObjectiveValue& other) const {
+            return { crossings + other.crossings, edge_length + other.edge_length };
+        }
+
+        ObjectiveValue operator- (const ObjectiveValue& other) const {
+            return { crossings - other.crossings, edge_length - other.edge_length };
+        }
+
+        bool operator== (const ObjectiveValue& other) const {
+            return crossings == other.crossings && edge_length == other.edge_length;
+        }
+    };
+
+    inline std::ostream& operator<<(std::ostream& out, const ObjectiveValue& value) {
+        out << "ObjectiveValue{ crossings=" << value.crossings << ", edge_length=" << value.edge_length << " }";
+        return out;
+    }
+
+    /**
+     * Sum of |pt1.y - pt2.y| over the Connexions in [begin, end), i.e. the total vertical length of the edges
+     */
+    template <bool UseNative=true>
+    int total_edge_length(const uint32_t* begin, const uint32_t* end) {
+        static_assert(sizeof(Connexion) == 4);
+        int length = 0;
+
+#ifdef __AVX512BW__
+        if constexpr (UseNative) {
+            // Move both y bytes of each connexion to the same byte, zeroing the rest, so the sum of absolute
+            // differences of each 8 bytes is the length of two connexions
+            const __m512i y_only = _mm512_set1_epi32(0x0000ff00);
+            __m512i sum = _mm512_setzero_si512();
+
+            while (end - begin >= 16) {
+                __m512i load = _mm512_loadu_si512(begin);
+                __m512i y1 = _mm512_and_si512(load, y_only);
+                __m512i y2 = _mm512_and_si512(_mm512_srli_epi32(load, 16), y_only);
+
+                sum = _mm512_add_epi64(sum, _mm512_sad_epu8(y1, y2));
+                begin += 16;
+            }
+
+            length = static_cast<int>(_mm512_reduce_add_epi64(sum));
+        }
+#endif
+
+        for (const auto* c = reinterpret_cast<const Connexion*>(begin); c < reinterpret_cast<const Connexion*>(end); ++c) {
+            length += std::abs(c->pt1.y - c->pt2.y);
+        }
+
+        return length;
+    }
+
+    template <bool UseNative=true>
+    int total_edge_length(const std::vector<Connexion>& connexions) {
+        return total_edge_length<UseNative>((const uint32_t*)connexions.data(),
+                                            (const uint32_t*)(connexions.data() + connexions.size()));
+    }
+
     namespace {
         int cross(Point a, Point b) {
             return a.x*b.y - a.y*b.x;
@@ -167,7 +285,7 @@ namespace classgraph {
             int proper = oa * ob < 0 && oc * od < 0;
             int improper = oa * ob <= 0 && oc * od <= 0;
 
-            return { .proper = proper, .improper = improper };
+            return { proper, improper };
         }
 
         using PermType = const std::array<
@@ -283,7 +401,7 @@ namespace classgraph {
             static __m512i ddbb_xy = perm_512_8xy8(A{ { { d, false }, { d, false }, { b, false }, { b, false } } });
             static __m512i ccaa_xy = perm_512_8xy8(A{ { { c, false }, { c, false }, { a, false }, { a, false } } });
             static __m512i abcd_yx = perm_512_8xy8(A{ { { a, true }, { b, true }, { c, true }, { d, true } } });
-            static __m512i ccaa_yx = perm_512_8xy8(A{ { { c, true }, { c, true }, { a, false }, { a, false } } }); 
+            static __m512i ccaa_yx = perm_512_8xy8(A{ { { c, true }, { c, true }, { a, true }, { a, true } } }); 
 
 
             // d - c  d - c  b - a  b - a
@@ -305,67 +423,397 @@ namespace classgraph {
             int nonpositives = negatives | _mm512_testn_epi32_mask(prods, prods);
 
             *lt0 = negatives & ((negatives & 0xaaaa) >> 1);
-            *le0 = (nonpositives | (nonpositives >> 1)) & 0x5555;
-#endif
+            *le0 = nonpositives & (nonpositives >> 1) & 0x5555;
         }
-
+#endif
     }
 
 
-    template <bool UseNative=true>
-    IntersectionCounters count_intersections(const uint64_t* begin_, const uint64_t* end_) {
+    inline IntersectionCounters count_intersections_scalar(const uint64_t* begin_, const uint64_t* end_) {
         static_assert(sizeof(SmallPoint) == 2);
         const SmallPoint* begin = (const SmallPoint*)begin_;
         const SmallPoint* end = (const SmallPoint*) end_;
 
         IntersectionCounters result;
 
+        while (begin < end) {
+            SmallPoint a = *begin, b = *(begin + 1), c = *(begin + 2), d = *(begin + 3);
+            result += intersects(a.point(), b.point(), c.point(), d.point());
+            begin += 4;
+        }
+
+        return result;
+    }
+
 #ifdef __AVX512BW__
-        if constexpr (UseNative) {
-            auto do_with_mask = [&] (int mask_shift) {
-                int mask = mask_shift >= 8 ? -1 : (((uint32_t)1 << mask_shift) - 1);
-                __m512i load = _mm512_maskz_loadu_epi32(mask, (const __m512i*) begin);
+    inline IntersectionCounters count_intersections_avx512(const uint64_t* begin_, const uint64_t* end_) {
+        const SmallPoint* begin = (const SmallPoint*)begin_;
+        const SmallPoint* end = (const SmallPoint*) end_;
 
-                int lt0, le0;
-                calculate_signs(load, &lt0, &le0);
+        IntersectionCounters result;
 
-                lt0 &= mask;
-                le0 &= mask;
+        auto do_with_mask = [&] (int mask_shift) {
+            // mask_shift counts remaining 32-bit lanes, of which there are 16 per vector
+            int mask = mask_shift >= 16 ? -1 : (((uint32_t)1 << mask_shift) - 1);
+            __m512i load = _mm512_maskz_loadu_epi32(mask, (const __m512i*) begin);
 
-                result += IntersectionCounters { __builtin_popcount(lt0), __builtin_popcount(le0) };
-            };
+            int lt0, le0;
+            calculate_signs(load, &lt0, &le0);
+
+            lt0 &= mask;
+            le0 &= mask;
+
+            result += IntersectionCounters { __builtin_popcount(lt0), __builtin_popcount(le0) };
+        };
+
+        while (begin < end) {
+            ptrdiff_t mask_shift = (end - begin) >> 1;
+            do_with_mask(mask_shift);
+            begin += 32;
+        }
+
+        return result;
+    }
+#endif
 
-#if 0
-            // Align me to 64-byte boundary
-            int rem = (uintptr_t)begin % 64;
-            if (rem != 0) {
-                rem = 32 - (rem >> 1);
-                do_with_mask(rem);
-                begin += rem;
+    template <bool UseNative=true>
+    IntersectionCounters count_intersections(const uint64_t* begin, const uint64_t* end) {
+#ifdef __AVX512BW__
+        if constexpr (UseNative) {
+            if (static_cast<size_t>(end - begin) >= kernel_tuning.count_512_min) {
+                return count_intersections_avx512(begin, end);
             }
+        }
 #endif
 
-            while (begin < end) {
-                ptrdiff_t mask_shift = (end - begin) >> 1;
-                do_with_mask(mask_shift);
-                begin += 32;
+        return count_intersections_scalar(begin, end);
+    }
+
+    template <bool UseNative=true, typename T>
+    IntersectionCounters count_intersections(const std::vector<T>& inter) {
+        return count_intersections<UseNative>((const uint64_t*)inter.data(), (const uint64_t*)(inter.data() + inter.size()));
+    }
+
+    /**
+     * Count intersections of the IndexedIntersections in [begin, end), looking up the point of each class ID in
+     * positions, which must have 256 entries.
+     */
+    template <bool UseNative=true>
+    IntersectionCounters count_intersections_indexed(const uint32_t* begin, const uint32_t* end,
+                                                     const SmallPoint* positions) {
+        static_assert(sizeof(IndexedIntersection) == 4);
+        IntersectionCounters result;
+
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+        if constexpr (UseNative) {
+            // Split the table into 256 x bytes and 256 y bytes, which fit in four registers each
+            alignas(64) static const auto deinterleave = [] {
+                std::array<std::array<uint8_t, 64>, 2> idx{};
+                for (int i = 0; i < 64; ++i) {
+                    idx[0][i] = 2 * i;
+                    idx[1][i] = 2 * i + 1;
+                }
+                return idx;
+            }();
+
+            __m512i even = _mm512_loadu_si512(deinterleave[0].data()), odd = _mm512_loadu_si512(deinterleave[1].data());
+            __m512i xs[4], ys[4];
+
+            for (int k = 0; k < 4; ++k) {
+                __m512i lo = _mm512_loadu_si512(positions + 64 * k), hi = _mm512_loadu_si512(positions + 64 * k + 32);
+
+                xs[k] = _mm512_permutex2var_epi8(lo, even, hi);
+                ys[k] = _mm512_permutex2var_epi8(lo, odd, hi);
             }
 
-            return result;
+            // vpermi2b selects from 128 bytes with the low 7 bits; the top bit picks which half of the table
+            auto lookup = [] (const __m512i* table, __m512i ids) {
+                __m512i low = _mm512_permutex2var_epi8(table[0], ids, table[1]);
+                __m512i high = _mm512_permutex2var_epi8(table[2], ids, table[3]);
+
+                return _mm512_mask_blend_epi8(_mm512_movepi8_mask(ids), low, high);
+            };
+
+            while (end - begin >= 16) {
+                __m512i ids = _mm512_loadu_si512(begin);
+                __m512i x = lookup(xs, ids), y = lookup(ys, ids);
+
+                // Interleaving within 128-bit lanes keeps each group of four points together, which is all
+                // calculate_signs needs
+                int lt0, le0;
+                calculate_signs(_mm512_unpacklo_epi8(x, y), &lt0, &le0);
+                result += IntersectionCounters { __builtin_popcount(lt0), __builtin_popcount(le0) };
+
+                calculate_signs(_mm512_unpackhi_epi8(x, y), &lt0, &le0);
+                result += IntersectionCounters { __builtin_popcount(lt0), __builtin_popcount(le0) };
+
+                begin += 16;
+            }
         }
 #endif
 
-        while (begin < end) {
-            SmallPoint a = *begin, b = *(begin + 1), c = *(begin + 2), d = *(begin + 3);
-            result += intersects(a.point(), b.point(), c.point(), d.point());
-            begin += 4;
+        const auto* ids = reinterpret_cast<const IndexedIntersection*>(begin);
+        const auto* ids_end = reinterpret_cast<const IndexedIntersection*>(end);
+
+        for (; ids < ids_end; ++ids) {
+            result += intersects(positions[ids->a].point(), positions[ids->b].point(),
+                                 positions[ids->c].point(), positions[ids->d].point());
         }
 
         return result;
     }
 
-    template <bool UseNative=true, typename T>
-    IntersectionCounters count_intersections(const std::vector<T>& inter) {
-        return count_intersections((const uint64_t*)&*inter.begin(), (const uint64_t*)&*inter.end());
+    template <bool UseNative=true>
+    IntersectionCounters count_intersections_indexed(const std::vector<IndexedIntersection>& inter,
+                                                     const PositionTable& positions) {
+        return count_intersections_indexed<UseNative>((const uint32_t*)inter.data(),
+                                                      (const uint32_t*)(inter.data() + inter.size()),
+                                                      positions.data());
+    }
+
+    // Set bits of a row. A full CrossingBitsets row is one 256-bit VPOPCNTQ where AVX-512 has it
+    template <size_t Words>
+    int popcount(const std::array<uint64_t, Words>& bits) {
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+        if constexpr (Words == 4) {
+            __m256i counts = _mm256_popcnt_epi64(_mm256_loadu_si256((const __m256i*) bits.data()));
+            __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(counts), _mm256_extracti128_si256(counts, 1));
+
+            return static_cast<int>(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+        }
+#endif
+        int count = 0;
+        for (uint64_t word : bits) {
+            count += __builtin_popcountll(word);
+        }
+        return count;
     }
+
+    // Sum of the indices of the set bits, from the popcount of word against a mask for each bit of the index
+    inline int index_sum(uint64_t word) {
+        constexpr uint64_t INDEX_BITS[6] = {
+            0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+            0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+        };
+
+        int sum = 0;
+        for (int k = 0; k < 6; ++k) {
+            sum += __builtin_popcountll(word & INDEX_BITS[k]) << k;
+        }
+        return sum;
+    }
+
+    /**
+     * Pairs of a set in upper and b set in lower with a > b, within one word. Over a of upper, the bits of lower below
+     * a are the bits of upper | lower below it, minus those of upper, plus those of upper & lower; each of these rank
+     * sums is an index_sum once PEXT has packed the bits of a by rank. Without BMI2 it sums, over every position a,
+     * whether upper has it times the popcount of lower masked below a. Neither walks the set bits.
+     */
+    inline int word_crossings(uint64_t upper, uint64_t lower) {
+#ifdef __BMI2__
+        uint64_t shared = upper & lower;
+        int upper_count = __builtin_popcountll(upper), shared_count = __builtin_popcountll(shared);
+
+        // Each element of shared is above upper_count - 1 - (its rank in upper) others of upper
+        return index_sum(_pext_u64(upper, upper | lower)) - upper_count * (upper_count - 1) / 2
+            + shared_count * (upper_count - 1) - index_sum(_pext_u64(shared, upper));
+#else
+        int count = 0;
+        for (int a = 1; a < 64; ++a) {
+            int upper_has = static_cast<int>((upper >> a) & 1);
+            count += upper_has * __builtin_popcountll(lower & ((1ULL << a) - 1));
+        }
+        return count;
+#endif
+    }
+
+    // Same as word_crossings, walking the set bits of upper. Cheaper while upper has only a few
+    inline int sparse_word_crossings(uint64_t upper, uint64_t lower) {
+        int count = 0;
+        for (; upper; upper &= upper - 1) {
+            count += __builtin_popcountll(lower & ((1ULL << __builtin_ctzll(upper)) - 1));
+        }
+        return count;
+    }
+
+    /**
+     * Crossings between the edges of two classes in a term, upper placed above lower, into the same adjacent term.
+     * A neighbour a of upper and b of lower cross exactly when a > b: pairs within a word, plus every neighbour of
+     * upper in a word against the neighbours of lower in the words before it. Single-word rows are the small fixed
+     * buckets, whose classes have a handful of neighbours each, so they walk the set bits instead.
+     */
+    template <size_t Words>
+    int pair_crossings(const std::array<uint64_t, Words>& upper, const std::array<uint64_t, Words>& lower) {
+        if constexpr (Words == 1) {
+            return sparse_word_crossings(upper[0], lower[0]);
+        }
+
+        int count = 0;
+        // Neighbours of lower in the words before w
+        int below = 0;
+        for (size_t w = 0; w < Words; ++w) {
+            count += word_crossings(upper[w], lower[w]) + __builtin_popcountll(upper[w]) * below;
+            below += __builtin_popcountll(lower[w]);
+        }
+        return count;
+    }
+
+    /**
+     * pair_crossings(lower, upper) - pair_crossings(upper, lower): the change in crossings if the two classes traded
+     * places. Every pair of neighbours crosses in exactly one of the two orders unless it is the same position, so
+     * this needs only one pair_crossings. Walking a sparse single word both ways is cheaper than the popcounts.
+     */
+    template <size_t Words>
+    int pair_swap_delta(const std::array<uint64_t, Words>& upper, const std::array<uint64_t, Words>& lower) {
+        if constexpr (Words == 1) {
+            return sparse_word_crossings(lower[0], upper[0]) - sparse_word_crossings(upper[0], lower[0]);
+        }
+
+        std::array<uint64_t, Words> shared;
+        for (size_t w = 0; w < Words; ++w) {
+            shared[w] = upper[w] & lower[w];
+        }
+
+        return popcount(upper) * popcount(lower) - popcount(shared) - 2 * pair_crossings(upper, lower);
+    }
+
+    /**
+     * Crossing engine for edges between adjacent terms, over at most MaxTerms terms of at most MaxPositions classes.
+     * For every position in a term, the positions it connects to in the previous and next terms are kept as bitsets,
+     * so crossings of two classes are popcounts of masked ANDs. Storage is fixed-size, so a small bucket stays in
+     * cache and needs no allocation. Connexions skipping terms aren't represented; Layout::with_waypoints splits them
+     * up beforehand.
+     */
+    template <int MaxTerms, int MaxPositions>
+    class BasicCrossingBitsets {
+        static_assert(MaxTerms <= MAX_TERMS);
+        static_assert(MaxPositions <= NO_CLASS_ID + 1);
+
+    public:
+        using Row = std::array<uint64_t, (MaxPositions + 63) / 64>;
+
+    private:
+        using Rows = std::array<Row, MaxPositions>;
+
+        int terms = 0;
+        std::array<int, MaxTerms> sizes{};
+        // next[t][p]: positions in term t + 1 connected to position p of term t. prev likewise for term t - 1
+        std::array<Rows, MaxTerms> next{};
+        std::array<Rows, MaxTerms> prev{};
+
+        static void set_bit(Row& bits, int pos) {
+            bits[pos >> 6] |= 1ULL << (pos & 63);
+        }
+
+        static void swap_bits(Row& bits, int i, int j) {
+            uint64_t bi = (bits[i >> 6] >> (i & 63)) & 1, bj = (bits[j >> 6] >> (j & 63)) & 1;
+            uint64_t diff = bi ^ bj;
+
+            bits[i >> 6] ^= diff << (i & 63);
+            bits[j >> 6] ^= diff << (j & 63);
+        }
+
+        static int term_crossings(const Rows& rows, int size) {
+            int count = 0;
+            for (int p = 0; p < size; ++p) {
+                for (int q = p + 1; q < size; ++q) {
+                    count += pair_crossings(rows[p], rows[q]);
+                }
+            }
+            return count;
+        }
+
+        static int rows_swap_delta(const Rows& rows, int i, int j) {
+            // Only pairs involving i or j and something between them change their relative order
+            const auto& u = rows[i];
+            const auto& v = rows[j];
+
+            int delta = pair_swap_delta(u, v);
+            for (int k = i + 1; k < j; ++k) {
+                const auto& w = rows[k];
+                delta += pair_swap_delta(u, w) + pair_swap_delta(w, v);
+            }
+
+            return delta;
+        }
+
+    public:
+        // Whether layout has few enough terms and classes per term for this bucket
+        static bool fits(const Layout& layout) {
+            if (layout.term_count() > MaxTerms) {
+                return false;
+            }
+
+            return std::all_of(layout.get_terms().begin(), layout.get_terms().end(), [] (const auto& term) {
+                return term.size() <= MaxPositions;
+            });
+        }
+
+        explicit BasicCrossingBitsets(const Layout& layout) : terms(static_cast<int>(layout.term_count())) {
+            assert(fits(layout));
+
+            layout.for_each_term([&] (const auto& term, int term_i) {
+                sizes[term_i] = static_cast<int>(term.size());
+            });
+
+            layout.for_each_connexion([&] (const Connexion& c) {
+                auto [from, to] = c.pt1.x < c.pt2.x ? std::pair { c.pt1, c.pt2 } : std::pair { c.pt2, c.pt1 };
+                if (to.x != from.x + 1) {
+                    return;
+                }
+
+                set_bit(next[from.x][from.y], to.y);
+                set_bit(prev[to.x][to.y], from.y);
+            });
+        }
+
+        int term_size(int term) const {
+            return sizes[term];
+        }
+
+        const Row& next_row(int term, int pos) const {
+            return next[term][pos];
+        }
+
+        const Row& prev_row(int term, int pos) const {
+            return prev[term][pos];
+        }
+
+        // Total proper crossings between adjacent terms
+        int count() const {
+            int count = 0;
+            for (int t = 0; t < terms; ++t) {
+                count += term_crossings(next[t], sizes[t]);
+            }
+            return count;
+        }
+
+        // Change in count() if positions i and j of the term were swapped
+        int swap_delta(int term, int i, int j) const {
+            if (i > j) {
+                std::swap(i, j);
+            }
+            return rows_swap_delta(next[term], i, j) + rows_swap_delta(prev[term], i, j);
+        }
+
+        void swap(int term, int i, int j) {
+            std::swap(next[term][i], next[term][j]);
+            std::swap(prev[term][i], prev[term][j]);
+
+            // Neighbouring terms refer to these positions by bit
+            if (term > 0) {
+                for (int p = 0; p < sizes[term - 1]; ++p) {
+                    swap_bits(next[term - 1][p], i, j);
+                }
+            }
+            if (term + 1 < terms) {
+                for (int p = 0; p < sizes[term + 1]; ++p) {
+                    swap_bits(prev[term + 1][p], i, j);
+                }
+            }
+        }
+    };
+
+    // Positions in a term fit in a byte, so this fits any layout. Its rows take about 200 KB
+    using CrossingBitsets = BasicCrossingBitsets<MAX_TERMS, NO_CLASS_ID + 1>;
 }
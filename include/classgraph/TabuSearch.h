@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Layout.h"
+#include "Swaps.h"
+#include "Optimizer.h"
+#include <vector>
+#include <bitset>
+#include <optional>
+
+namespace classgraph {
+    struct TabuOptions {
+        int iterations = 2000;
+        // Number of iterations a swap stays forbidden after being made
+        int tenure = 30;
+        // Terms whose classes may be swapped, or all of them if unset
+        std::optional<std::vector<int>> active_terms{};
+        Objective objective{};
+
+        Deadline deadline{};
+        // Not owned
+        Checkpointer* checkpointer = nullptr;
+    };
+
+    /**
+     * Steepest-descent tabu search over swaps of two classes in the same term. The objective delta of every swap is
+     * cached, and after each move only swaps whose classes share a possible intersection or a connexion with the
+     * moved classes are re-evaluated. Tabu swaps are still taken if they reach a new best (aspiration).
+     */
+    class TabuSearch {
+        struct Move {
+            ClassID a;
+            ClassID b;
+            ObjectiveValue delta;
+            int tabu_until;
+        };
+
+        TabuOptions options;
+
+        Layout layout;
+        IntersectionStorage initial_storage;
+        std::vector<Move> moves;
+
+        // Indices into the layout's indexed intersections involving each class
+        std::vector<std::vector<uint32_t>> intersections_of;
+        // Indices of the connexions ending at each class
+        std::vector<std::vector<uint32_t>> connexions_of;
+        // Classes sharing a possible intersection or a connexion with each class
+        std::vector<std::bitset<NO_CLASS_ID + 1>> related;
+
+        ObjectiveValue best_value{};
+        std::array<uint8_t, NO_CLASS_ID + 1> best_orders{};
+
+        ObjectiveValue swap_delta(ClassID a, ClassID b) const;
+        void save_best(ObjectiveValue value);
+        Layout best_layout() const;
+
+    public:
+        explicit TabuSearch(const Layout& initial, TabuOptions options = {});
+
+        Layout optimize();
+
+        IntersectionCounters get_best_score() const {
+            return best_value.crossings;
+        }
+
+        ObjectiveValue get_best_value() const {
+            return best_value;
+        }
+    };
+}
@@ -0,0 +1,35 @@
+#include "classgraph/Anytime.h"
+#include <csignal>
+
+namespace classgraph {
+    namespace {
+        // Bumped by the signal handler. A checkpoint is due while it differs from the last request each Checkpointer
+        // handled
+        volatile std::sig_atomic_t checkpoint_requests = 0;
+
+        void request_checkpoint(int) {
+            checkpoint_requests = checkpoint_requests + 1;
+        }
+    }
+
+    Checkpointer::Checkpointer(std::function<void(const Layout&)> write, std::chrono::milliseconds interval)
+        : write(std::move(write)), interval(interval), last_written(std::chrono::steady_clock::now()),
+          handled_requests(checkpoint_requests) {
+
+    }
+
+    bool Checkpointer::due() const {
+        return checkpoint_requests != handled_requests
+            || std::chrono::steady_clock::now() - last_written >= interval;
+    }
+
+    void Checkpointer::checkpoint(const Layout& best) {
+        handled_requests = checkpoint_requests;
+        write(best);
+        last_written = std::chrono::steady_clock::now();
+    }
+
+    void install_checkpoint_signal() {
+        std::signal(SIGUSR1, request_checkpoint);
+    }
+}
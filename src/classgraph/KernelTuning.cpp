@@ -0,0 +1,162 @@
+#include "classgraph/KernelTuning.h"
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace classgraph {
+    namespace {
+        constexpr std::array<size_t, 12> CALIBRATION_SIZES = { 4, 8, 16, 24, 32, 48, 64, 96, 128, 256, 1024, 4096 };
+        constexpr int CALIBRATION_ROUNDS = 5;
+        // Elements processed per timed round, so small sizes are timed over enough calls
+        constexpr size_t ELEMENTS_PER_ROUND = 1 << 16;
+
+        using Timings = std::array<double, CALIBRATION_SIZES.size()>;
+
+        // Best-of-rounds nanoseconds per call of fn(size)
+        template <typename Fn>
+        double time_per_call(size_t size, Fn&& fn) {
+            size_t calls = std::max<size_t>(ELEMENTS_PER_ROUND / size, 16);
+            double best = std::numeric_limits<double>::infinity();
+
+            fn(size);  // warm up
+            for (int round = 0; round < CALIBRATION_ROUNDS; ++round) {
+                auto start = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < calls; ++i) {
+                    fn(size);
+                }
+                std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+                best = std::min(best, elapsed.count() / calls);
+            }
+
+            return best;
+        }
+
+        template <typename Fn>
+        Timings time_sizes(Fn&& fn) {
+            Timings timings;
+            for (size_t i = 0; i < CALIBRATION_SIZES.size(); ++i) {
+                timings[i] = time_per_call(CALIBRATION_SIZES[i], fn);
+            }
+            return timings;
+        }
+
+        // Smallest size from which candidate stays faster than baseline, or SIZE_MAX if it never does
+        [[maybe_unused]] size_t crossover(const Timings& candidate, const Timings& baseline) {
+            size_t threshold = SIZE_MAX;
+            for (size_t i = CALIBRATION_SIZES.size(); i-- > 0;) {
+                if (candidate[i] >= baseline[i]) {
+                    break;
+                }
+                threshold = CALIBRATION_SIZES[i];
+            }
+            return threshold == CALIBRATION_SIZES.front() ? 0 : threshold;
+        }
+
+        [[maybe_unused]] Timings fastest(const Timings& a, const Timings& b) {
+            Timings result;
+            for (size_t i = 0; i < result.size(); ++i) {
+                result[i] = std::min(a[i], b[i]);
+            }
+            return result;
+        }
+    }
+
+    KernelTuning calibrate_kernels() {
+        KernelTuning tuning;
+
+        std::mt19937 rng(0);
+        std::uniform_int_distribution<uint16_t> small(0, 7);
+
+        std::vector<uint16_t> values(CALIBRATION_SIZES.back());
+        for (auto& value : values) {
+            value = small(rng);
+        }
+
+        auto swap_with = [&] (auto kernel) {
+            return time_sizes([&] (size_t size) {
+                kernel(values.data(), values.data() + size, 1, 2);
+            });
+        };
+
+        [[maybe_unused]] Timings swap_timings = swap_with(swap_small_points_scalar);
+
+#ifdef __AVX2__
+        Timings swap_256 = swap_with(swap_small_points_avx2);
+        tuning.swap_256_min = crossover(swap_256, swap_timings);
+        swap_timings = fastest(swap_timings, swap_256);
+#endif
+#if defined(__AVX512VL__) && defined(__AVX512BW__)
+        tuning.swap_512_min = crossover(swap_with(swap_small_points_avx512), swap_timings);
+#endif
+
+#ifdef __AVX512BW__
+        std::vector<Intersection> intersections(CALIBRATION_SIZES.back());
+        for (auto& inter : intersections) {
+            for (SmallPoint* pt : { &inter.c1.pt1, &inter.c1.pt2, &inter.c2.pt1, &inter.c2.pt2 }) {
+                *pt = SmallPoint { static_cast<uint8_t>(small(rng)), static_cast<uint8_t>(small(rng)) };
+            }
+        }
+
+        volatile int sink = 0;
+        auto count_with = [&] (auto kernel) {
+            return time_sizes([&] (size_t size) {
+                auto* begin = reinterpret_cast<const uint64_t*>(intersections.data());
+                sink = sink + kernel(begin, begin + size).proper;
+            });
+        };
+
+        tuning.count_512_min = crossover(count_with(count_intersections_avx512), count_with(count_intersections_scalar));
+#endif
+
+        return tuning;
+    }
+
+    void save_kernel_tuning(const KernelTuning& tuning, const std::string& filename) {
+        std::ofstream out(filename);
+        if (!out) {
+            throw std::runtime_error("Failed to open " + filename + " for writing");
+        }
+
+        out << "swap_512_min " << tuning.swap_512_min << "\n"
+            << "swap_256_min " << tuning.swap_256_min << "\n"
+            << "count_512_min " << tuning.count_512_min << "\n"
+            << "parallel_count_min " << tuning.parallel_count_min << "\n";
+    }
+
+    bool load_kernel_tuning(KernelTuning& tuning, const std::string& filename) {
+        std::ifstream in(filename);
+        if (!in) {
+            return false;
+        }
+
+        std::string key;
+        size_t value;
+        while (in >> key >> value) {
+            if (key == "swap_512_min") {
+                tuning.swap_512_min = value;
+            } else if (key == "swap_256_min") {
+                tuning.swap_256_min = value;
+            } else if (key == "count_512_min") {
+                tuning.count_512_min = value;
+            } else if (key == "parallel_count_min") {
+                tuning.parallel_count_min = value;
+            }
+        }
+
+        return true;
+    }
+
+    std::ostream& operator<<(std::ostream& out, const KernelTuning& tuning) {
+        auto size = [] (size_t threshold) {
+            return threshold == SIZE_MAX ? std::string("never") : std::to_string(threshold);
+        };
+
+        out << "KernelTuning{ swap_512_min=" << size(tuning.swap_512_min) << ", swap_256_min=" << size(tuning.swap_256_min)
+            << ", count_512_min=" << size(tuning.count_512_min)
+            << ", parallel_count_min=" << size(tuning.parallel_count_min) << " }";
+        return out;
+    }
+}
@@ -5,66 +5,202 @@
 #include "classgraph/Layout.h"
 #include "safe_int_cast.h"
 #include "classgraph/Swaps.h"
+#include "classgraph/Parallel.h"
 #include <cassert>
 #include <algorithm>
 #include <vector>
 #include <utility>
 #include <numeric>
 #include <random>
+#include <cstdlib>
+#include <stdexcept>
+#include <charconv>
+#include <iterator>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
 
 using namespace anematode;
 
-std::random_device rd;
-std::mt19937 g(rd());
+// Per thread, so layouts can be shuffled from concurrent optimizers
+thread_local std::mt19937 g(std::random_device{}());
 
 namespace classgraph {
     Layout::Layout(const NodeInfo& info, Terms&& terms) : node_info(info), terms(terms) {
 
     }
 
-    Layout Layout::read(std::istream &in) {
-        int term_count;
-        assert(in >> term_count);
-        assert(term_count > 0);
+    namespace {
+        // Whitespace-separated integers over a buffer, for Layout::parse
+        class TextReader {
+            const char* begin;
+            const char* pos;
+            const char* end;
 
-        NodeInfo nodes;
-        Terms terms;
+        public:
+            explicit TextReader(std::string_view text) : begin(text.data()), pos(text.data()), end(text.data() + text.size()) {}
 
-        std::fill(nodes.begin(), nodes.end(), Node(-1, 0, NO_CLASS_ID));
+            [[noreturn]] void fail(const std::string& message) const {
+                throw LayoutParseError(message, 1 + std::count(begin, pos, '\n'));
+            }
+
+            // Next integer, which must lie in [min, max]
+            int next_int(const char* what, int min, int max) {
+                while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) {
+                    pos++;
+                }
+
+                if (pos == end) {
+                    fail(std::string("unexpected end of input, expected ") + what);
+                }
+
+                int value;
+                auto [next, error] = std::from_chars(pos, end, value);
+                if (error != std::errc {}) {
+                    fail(std::string("expected ") + what);
+                }
+
+                if (value < min || value > max) {
+                    fail(std::string(what) + " " + std::to_string(value) + " out of range [" + std::to_string(min)
+                         + ", " + std::to_string(max) + "]");
+                }
+
+                pos = next;
+                return value;
+            }
+        };
+    }
+
+    namespace {
+        // Call fn with the contents of the file, mapped in place where possible
+        template <typename Fn>
+        void with_file_text(const std::string& filename, Fn&& fn) {
+#if __has_include(<sys/mman.h>)
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("Failed to open " + filename);
+            }
+
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                close(fd);
+                throw std::runtime_error("Failed to stat " + filename);
+            }
+
+            if (info.st_size == 0) {
+                close(fd);
+                fn(std::string_view {});  // nothing to map
+                return;
+            }
+
+            size_t size = info.st_size;
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
 
+            if (mapped == MAP_FAILED) {
+                throw std::runtime_error("Failed to map " + filename);
+            }
+
+            struct Unmap {
+                void* mapped;
+                size_t size;
+                ~Unmap() { munmap(mapped, size); }
+            } unmap { mapped, size };
+
+            fn(std::string_view { static_cast<const char*>(mapped), size });
+#else
+            std::ifstream in { filename, std::ios::binary };
+            if (!in) {
+                throw std::runtime_error("Failed to open " + filename);
+            }
+
+            thread_local std::string text;
+            text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            fn(std::string_view { text });
+#endif
+        }
+    }
+
+    void Layout::reload(std::string_view text) {
+        TextReader reader { text };
+
+        int term_count = reader.next_int("term count", 1, MAX_TERMS);
+
+        std::fill(node_info.begin(), node_info.end(), Node(-1, 0, NO_CLASS_ID));
+        waypoints.reset();
+
+        // Clear rather than replace the terms, so their storage is reused
         terms.resize(term_count);
+        for (auto& term : terms) {
+            term.clear();
+        }
+
         for (int i = 0; i < term_count; ++i) {
-            int term_i, count;
+            reader.next_int("term index", i, i);
+            int count = reader.next_int("class count", 0, MAX_CLASS_ID);
 
-            assert(in >> term_i >> count);
-            assert(term_i == i);
+            auto& term = terms[i];
+            term.reserve(count);
 
             for (int j = 0; j < count; ++j) {
-                int class_id, prereq_count;
-
-                assert(in >> class_id >> prereq_count);
+                int class_id = reader.next_int("class ID", 0, MAX_CLASS_ID - 1);
+                if (node_info[class_id].class_id != NO_CLASS_ID) {
+                    reader.fail("duplicate class ID " + std::to_string(class_id));
+                }
 
-                terms.at(term_i).push_back(class_id);
-                nodes.at(class_id) = Node {
-                    checked_int_cast<int8_t>(term_i),
-                    checked_int_cast<uint8_t>(j),
-                    checked_int_cast<uint8_t>(class_id)
-                };
+                Node& node = node_info[class_id];
+                node = Node { static_cast<int8_t>(i), static_cast<uint8_t>(j), static_cast<uint8_t>(class_id) };
+                term.push_back(class_id);
 
-                // Read prereqs
+                int prereq_count = reader.next_int("prereq count", 0, MAX_PREREQS);
                 for (int k = 0; k < prereq_count; ++k) {
-                    int prereq;
+                    int prereq = reader.next_int("prereq ID", 0, MAX_CLASS_ID - 1);
+                    if (prereq == class_id) {
+                        reader.fail("class " + std::to_string(class_id) + " requires itself");
+                    }
 
-                    assert(in >> prereq);
-                    assert(prereq != class_id);
-
-                    nodes.at(class_id).prereqs[k] = prereq;
+                    node.prereqs[k] = prereq;
                 }
             }
         }
 
-        auto layout = Layout{ nodes, std::move(terms) };
-        layout.compute_possible_intersections();
+        compute_possible_intersections();
+    }
+
+    void Layout::reload(std::istream& in) {
+        thread_local std::string text;
+        text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+        reload(std::string_view { text });
+    }
+
+    void Layout::reload_file(const std::string& filename) {
+        with_file_text(filename, [&] (std::string_view text) {
+            reload(text);
+        });
+    }
+
+    Layout Layout::parse(std::string_view text) {
+        Layout layout { NodeInfo {}, Terms {} };
+        layout.reload(text);
+        return layout;
+    }
+
+    Layout Layout::read(std::istream &in) {
+        Layout layout { NodeInfo {}, Terms {} };
+        layout.reload(in);
+        return layout;
+    }
+
+    Layout Layout::read_file(const std::string& filename) {
+        Layout layout { NodeInfo {}, Terms {} };
+        layout.reload_file(filename);
         return layout;
     }
 
@@ -73,6 +209,15 @@ namespace classgraph {
         for_each_connexion([&] (const Connexion& c) {
             resolved_connexions.push_back(c);
         });
+
+        resolved_ends.clear();
+        for_each_class([&] (const Node& node) {
+            node.for_each_prereq([&] (ClassID prereq) {
+                if (has_class(prereq)) {
+                    resolved_ends.emplace_back(prereq, node.class_id);
+                }
+            });
+        });
     }
 
     void Layout::swap_nodes(Node& a, Node& b) {
@@ -81,47 +226,332 @@ namespace classgraph {
         SmallPoint ap = a.small_point(), bp = b.small_point();
         std::swap(a.order, b.order);
 
-        swap_small_points_vector(possible_intersections, ap.asU16(), bp.asU16());
+        if (storage == IntersectionStorage::Points) {
+            swap_small_points_vector(possible_intersections, ap.asU16(), bp.asU16());
+            swap_small_points_vector(resolved_connexions, ap.asU16(), bp.asU16());
+        } else {
+            std::swap(positions[a.class_id], positions[b.class_id]);
+        }
     }
 
     void Layout::compute_possible_intersections() {
+        compute_connexions();
+        possible_intersections.clear();
+        indexed_intersections.clear();
+
+        for_each_class([&] (const Node& node) {
+            positions[node.class_id] = node.small_point();
+        });
+
+        for (size_t i = 0; i < resolved_connexions.size(); ++i) {
+            const auto& c1 = resolved_connexions[i];
+            int c1_min = std::min(c1.pt1.x, c1.pt2.x), c1_max = std::max(c1.pt1.x, c1.pt2.x);
+
+            for (size_t j = i + 1; j < resolved_connexions.size(); ++j) {
+                const auto& c2 = resolved_connexions[j];
+                int c2_min = std::min(c2.pt1.x, c2.pt2.x), c2_max = std::max(c2.pt1.x, c2.pt2.x);
+
+                // Connexions whose terms overlap in at most one term can only meet at a node there, and nodes don't
+                // share a point; unless one is a corequisite lying along that term, which can pass through the other
+                int overlap_min = std::max(c1_min, c2_min), overlap_max = std::min(c1_max, c2_max);
+                bool corequisite = c1_min == c1_max || c2_min == c2_max;
+                if (overlap_min > overlap_max || (overlap_min == overlap_max && !corequisite)) {
+                    continue;
+                }
+
+                // Connexions sharing a node always touch there, no matter the order, so they're uninteresting
+                auto [a, b] = resolved_ends[i];
+                auto [c, d] = resolved_ends[j];
+                if (a == c || a == d || b == c || b == d) {
+                    continue;
+                }
+
+                if (storage == IntersectionStorage::Points) {
+                    possible_intersections.push_back(Intersection { c1, c2 });
+                } else {
+                    indexed_intersections.push_back(IndexedIntersection { a, b, c, d });
+                }
+            }
+        }
+    }
+
+    void Layout::set_intersection_storage(IntersectionStorage new_storage) {
+        storage = new_storage;
+        compute_possible_intersections();
+    }
+
+    IntersectionCounters Layout::count_crossings() const {
+        if (storage == IntersectionStorage::Points) {
+            return count_intersections_parallel(possible_intersections);
+        }
+
+        return count_intersections_indexed(indexed_intersections, positions);
+    }
+
+    int Layout::edge_length() const {
+        if (storage == IntersectionStorage::Points) {
+            return total_edge_length(resolved_connexions);
+        }
+
+        int length = 0;
+        for (auto [a, b] : resolved_ends) {
+            length += std::abs(positions[a].y - positions[b].y);
+        }
+
+        return length;
+    }
+
+    ObjectiveValue Layout::evaluate() const {
+        return { count_crossings(), edge_length() };
+    }
+
+    std::vector<ClassID> Layout::ordered_term(int term) const {
+        auto ordered = terms.at(term);
+        std::sort(ordered.begin(), ordered.end(), [&] (ClassID a, ClassID b) {
+            return get_class(a).order < get_class(b).order;
+        });
 
+        return ordered;
+    }
+
+    void Layout::set_term_order(int term, const std::vector<ClassID>& order) {
+        assert(order.size() == terms.at(term).size());
+
+        for (size_t i = 0; i < order.size(); ++i) {
+            auto& node = get_class_mut(order[i]);
+            assert(node.term == term);
+
+            node.order = checked_int_cast<uint8_t>(i);
+        }
     }
 
     void Layout::shuffle() {
-        for (auto & term : terms) {
-            std::vector<int> orders;
-            orders.resize(term.size());
+        for (int i = 0; i < terms.size(); ++i) {
+            shuffle_term(i);
+        }
+
+        compute_possible_intersections();
+    }
+
+    void Layout::shuffle_term(int term_i) {
+        const auto& term = terms.at(term_i);
+
+        // A term holds at most MAX_CLASS_ID classes, so the orders fit on the stack
+        std::array<uint8_t, MAX_CLASS_ID> orders;
+        auto orders_end = orders.begin() + term.size();
+
+        std::iota(orders.begin(), orders_end, 0);
+        std::shuffle(orders.begin(), orders_end, g);
+
+        for (int j = 0; j < term.size(); ++j) {
+            // Fix orders in node_info
+            node_info.at(term[j]).order = orders[j];
+        }
+    }
 
-            std::iota(orders.begin(), orders.end(), 0);
-            std::shuffle(orders.begin(), orders.end(), g);
 
-            for (int j = 0; j < term.size(); ++j) {
-                // Fix orders in node_info
-                node_info.at(term[j]).order = orders[j];
+    std::vector<std::vector<ClassID>> Layout::connected_components() const {
+        std::array<ClassID, NO_CLASS_ID + 1> parent;
+        std::iota(parent.begin(), parent.end(), 0);
+
+        auto find = [&] (ClassID id) {
+            while (parent[id] != id) {
+                parent[id] = parent[parent[id]];
+                id = parent[id];
             }
+            return id;
+        };
+
+        for_each_class([&] (const Node& node) {
+            node.for_each_prereq([&] (ClassID prereq) {
+                if (has_class(prereq)) {
+                    ClassID a = find(node.class_id), b = find(prereq);
+                    parent[std::max(a, b)] = std::min(a, b);
+                }
+            });
+        });
+
+        std::vector<std::vector<ClassID>> components;
+        std::array<int, NO_CLASS_ID + 1> component_of;
+        component_of.fill(-1);
+
+        // Classes are visited in increasing ID, and each root is the smallest ID of its component
+        for_each_class([&] (const Node& node) {
+            ClassID root = find(node.class_id);
+            if (component_of[root] == -1) {
+                component_of[root] = static_cast<int>(components.size());
+                components.emplace_back();
+            }
+
+            components[component_of[root]].push_back(node.class_id);
+        });
+
+        return components;
+    }
+
+    Layout Layout::sub_layout(const std::vector<ClassID>& classes) const {
+        NodeInfo nodes;
+        std::fill(nodes.begin(), nodes.end(), Node(-1, 0, NO_CLASS_ID));
+
+        for (ClassID id : classes) {
+            nodes.at(id) = get_class(id);
         }
+
+        Terms sub_terms(terms.size());
+        for (int term_i = 0; term_i < terms.size(); ++term_i) {
+            for (ClassID id : ordered_term(term_i)) {
+                if (nodes[id].class_id != NO_CLASS_ID) {
+                    nodes[id].order = checked_int_cast<uint8_t>(sub_terms[term_i].size());
+                    sub_terms[term_i].push_back(id);
+                }
+            }
+        }
+
+        Layout layout { nodes, std::move(sub_terms) };
+        layout.waypoints = waypoints;
+        layout.storage = storage;
+        layout.compute_possible_intersections();
+
+        return layout;
     }
 
+    Layout Layout::with_waypoints() const {
+        NodeInfo nodes = node_info;
+        Terms new_terms = terms;
+        auto added = waypoints;
+
+        // Where each node should go in its term; waypoints land between the orders of their edge's ends
+        std::array<float, NO_CLASS_ID + 1> position{};
+        for_each_class([&] (const Node& node) {
+            position[node.class_id] = node.order;
+        });
+
+        // IDs a prereq refers to stay taken even without a class, or the prereq would resolve to a waypoint
+        std::bitset<NO_CLASS_ID + 1> taken;
+        for_each_class([&] (const Node& node) {
+            taken.set(node.class_id);
+            for (ClassID prereq : node.prereqs) {
+                taken.set(prereq);
+            }
+        });
+
+        int next_free = 0;
+        auto allocate = [&] () {
+            while (next_free < MAX_CLASS_ID && taken[next_free]) {
+                next_free++;
+            }
+
+            if (next_free == MAX_CLASS_ID) {
+                throw std::length_error("Not enough unused class IDs for waypoints");
+            }
+
+            return static_cast<ClassID>(next_free);
+        };
+
+        for_each_class([&] (const Node& node) {
+            for (int k = 0; k < MAX_PREREQS && node.prereqs[k] != NO_CLASS_ID; ++k) {
+                ClassID prereq = node.prereqs[k];
+                if (!has_class(prereq)) {
+                    continue;
+                }
+
+                const Node& source = node_info[prereq];
+                int span = node.term - source.term;
+                if (std::abs(span) <= 1) {
+                    continue;
+                }
+
+                // Chain source -> waypoint -> ... -> node
+                int step = span > 0 ? 1 : -1;
+                ClassID previous = prereq;
+
+                for (int term_i = source.term + step; term_i != node.term; term_i += step) {
+                    ClassID id = allocate();
+
+                    Node waypoint { checked_int_cast<int8_t>(term_i), 0, id };
+                    waypoint.prereqs[0] = previous;
+                    nodes[id] = waypoint;
+                    taken.set(id);
+                    added.set(id);
+
+                    new_terms.at(term_i).push_back(id);
+                    position[id] = source.order + (node.order - source.order) * static_cast<float>(term_i - source.term) / span;
+
+                    previous = id;
+                }
+
+                nodes[node.class_id].prereqs[k] = previous;
+            }
+        });
+
+        for (const auto& term : new_terms) {
+            // Stable, so classes stay ahead of waypoints at the same position
+            auto ordered = term;
+            std::stable_sort(ordered.begin(), ordered.end(), [&] (ClassID a, ClassID b) {
+                return position[a] < position[b];
+            });
+
+            for (size_t i = 0; i < ordered.size(); ++i) {
+                nodes[ordered[i]].order = checked_int_cast<uint8_t>(i);
+            }
+        }
+
+        Layout layout { nodes, std::move(new_terms) };
+        layout.waypoints = added;
+        layout.storage = storage;
+        layout.compute_possible_intersections();
+
+        return layout;
+    }
+
+    Layout Layout::without_waypoints() const {
+        NodeInfo nodes = node_info;
+        Terms real_terms(terms.size());
+
+        for (int term_i = 0; term_i < terms.size(); ++term_i) {
+            for (ClassID id : ordered_term(term_i)) {
+                if (is_waypoint(id)) {
+                    nodes[id] = Node(-1, 0, NO_CLASS_ID);
+                } else {
+                    nodes[id].order = checked_int_cast<uint8_t>(real_terms[term_i].size());
+                    real_terms[term_i].push_back(id);
+                }
+            }
+        }
+
+        for (auto& node : nodes) {
+            if (node.class_id == NO_CLASS_ID) {
+                continue;
+            }
+
+            for (auto& prereq : node.prereqs) {
+                // Waypoints have exactly one prereq, leading back towards the original one
+                while (prereq != NO_CLASS_ID && is_waypoint(prereq)) {
+                    prereq = node_info[prereq].prereqs[0];
+                }
+            }
+        }
+
+        Layout layout { nodes, std::move(real_terms) };
+        layout.storage = storage;
+        layout.compute_possible_intersections();
+
+        return layout;
+    }
 
     bool Layout::is_compatible_with(const Layout &other) const {
         if (terms.size() != other.terms.size()) {
             return false;
         }
 
+        // Class IDs are unique, so equal sizes and every class of mine in the same term of other means equal sets
         for (size_t i = 0; i < terms.size(); ++i) {
-            auto my_term = terms[i];
-            auto other_term = other.terms[i];
-
-            if (my_term.size() != other_term.size()) {
+            if (terms[i].size() != other.terms[i].size()) {
                 return false;
             }
 
-            std::sort(my_term.begin(), my_term.end());
-            std::sort(other_term.begin(), other_term.end());
-
-            for (size_t j = 0; j < my_term.size(); ++j) {
-                if (my_term[j] != other_term[j]) {
+            for (ClassID id : terms[i]) {
+                if (!other.has_class(id) || other.node_info[id].term != static_cast<int8_t>(i)) {
                     return false;
                 }
             }
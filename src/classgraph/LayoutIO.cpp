@@ -4,80 +4,264 @@
 
 #include "classgraph/LayoutIO.h"
 #include <fstream>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <array>
+#include <charconv>
+#include <stdexcept>
 #include "safe_int_cast.h"
 
 using namespace anematode;
 
-void classgraph::LayoutIO::read_json(std::istream &in) {
-    json = nlohmann::json::parse(in);
+namespace {
+    /**
+     * Finds the byte spans of values in JSON text which is already known to be valid
+     */
+    class SpanScanner {
+        const std::string& text;
 
-    const auto& j = json.value();
-    const auto& terms_in = j["curriculum_terms"];
+    public:
+        explicit SpanScanner(const std::string& text) : text(text) {}
 
-    assert(terms_in.is_array());
+        size_t skip_whitespace(size_t pos) const {
+            while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' || text[pos] == '\r' || text[pos] == '\t')) {
+                pos++;
+            }
+            return pos;
+        }
 
-    decltype(read_layout->node_info) node_info;
-    decltype(read_layout->terms) terms;
+        // Position just after the string starting at pos
+        size_t skip_string(size_t pos) const {
+            assert(text[pos] == '"');
+            for (pos++; text[pos] != '"'; pos++) {
+                if (text[pos] == '\\') {
+                    pos++;
+                }
+            }
+            return pos + 1;
+        }
 
-    size_t term_count = terms_in.size();
-    assert(term_count <= MAX_TERMS);
-    terms.resize(term_count);
-    
-    int term_i = 0;
-    for (const auto& val : terms_in) {
-        const auto& items = val["curriculum_items"];
-        assert(items.is_array());
-        
-        int initial_class_order = 0;
-
-        for (const auto& class_ : items) {
-            assert(class_["id"].is_number_integer());
-            auto class_id = class_["id"].get<int>();
-            assert(class_id >= 0 && class_id <= MAX_CLASS_ID);
-            
-            Node classNode { checked_int_cast<int8_t>(term_i),
-                             checked_int_cast<uint8_t>(initial_class_order),
-                             checked_int_cast<uint8_t>(class_id) };
-
-            auto& prereqs = classNode.prereqs;
-            
-            const auto& prereqs_in = class_["curriculum_requisites"];
-            assert(prereqs_in.is_array());
-            
-            size_t prereq_count = prereqs_in.size();
-            assert(prereq_count <= MAX_PREREQS);
+        // Position just after the value starting at pos
+        size_t skip_value(size_t pos) const {
+            char c = text[pos];
+            if (c == '"') {
+                return skip_string(pos);
+            }
 
-            int prereq_i = 0;
-            for (const auto& prereq_pair : prereqs_in) {
-                const auto& source_id = prereq_pair["source_id"];
-                const auto& target_id = prereq_pair["target_id"];
+            if (c == '{' || c == '[') {
+                int depth = 0;
+                while (true) {
+                    c = text[pos];
+                    if (c == '"') {
+                        pos = skip_string(pos);
+                        continue;
+                    }
 
-                assert(source_id.is_number_integer());
-                assert(target_id.is_number_integer());
+                    pos++;
+                    if (c == '{' || c == '[') {
+                        depth++;
+                    } else if ((c == '}' || c == ']') && --depth == 0) {
+                        return pos;
+                    }
+                }
+            }
 
-                auto source_id_number = source_id.get<int>();
-                auto target_id_number = target_id.get<int>();
+            // Number or literal
+            while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ']'
+                   && skip_whitespace(pos) == pos) {
+                pos++;
+            }
+            return pos;
+        }
 
-                assert(source_id_number >= 0 && source_id_number <= MAX_CLASS_ID);
-                assert(target_id_number >= 0 && target_id_number <= MAX_CLASS_ID);
-                assert(target_id_number == class_id);
+        // Calls callback(element_begin, element_end) for each element of the array starting at pos
+        template <typename Lambda>
+        void for_each_element(size_t pos, Lambda callback) const {
+            assert(text[pos] == '[');
+            pos = skip_whitespace(pos + 1);
 
-                prereqs[prereq_i] = source_id_number;
-                prereq_i += 1;
+            while (text[pos] != ']') {
+                size_t end = skip_value(pos);
+                callback(pos, end);
+
+                pos = skip_whitespace(end);
+                if (text[pos] == ',') {
+                    pos = skip_whitespace(pos + 1);
+                }
+            }
+        }
+
+        // Start of the value of key in the object starting at pos, or npos
+        size_t find_key(size_t pos, std::string_view key) const {
+            assert(text[pos] == '{');
+            pos = skip_whitespace(pos + 1);
+
+            while (text[pos] != '}') {
+                size_t key_end = skip_string(pos);
+                bool matches = text.compare(pos + 1, key_end - pos - 2, key) == 0;
+
+                pos = skip_whitespace(key_end);
+                assert(text[pos] == ':');
+                pos = skip_whitespace(pos + 1);
+
+                if (matches) {
+                    return pos;
+                }
+
+                pos = skip_whitespace(skip_value(pos));
+                if (text[pos] == ',') {
+                    pos = skip_whitespace(pos + 1);
+                }
             }
 
-            initial_class_order += 1;
+            return std::string::npos;
+        }
+    };
+}
+
+namespace {
+    // Value of key in the object at pos, failing if pos isn't an object or lacks the key
+    size_t require_key(const SpanScanner& scanner, const std::string& text, size_t pos, std::string_view key) {
+        size_t value = text[pos] == '{' ? scanner.find_key(pos, key) : std::string::npos;
+        if (value == std::string::npos) {
+            throw std::runtime_error("Expected an object with \"" + std::string(key) + "\" at byte " + std::to_string(pos));
+        }
+        return value;
+    }
+
+    size_t require_array(const std::string& text, size_t pos, const char* what) {
+        if (text[pos] != '[') {
+            throw std::runtime_error(std::string("Expected ") + what + " to be an array at byte " + std::to_string(pos));
         }
+        return pos;
     }
 
-    read_layout.emplace(node_info, std::move(terms));
+    // The integer at pos, which must lie in [min, max]
+    int require_int(const SpanScanner& scanner, const std::string& text, size_t pos, int min, int max, const char* what) {
+        size_t end = scanner.skip_value(pos);
+
+        int value;
+        auto [next, error] = std::from_chars(text.data() + pos, text.data() + end, value);
+        if (error != std::errc {} || next != text.data() + end || value < min || value > max) {
+            throw std::runtime_error(std::string("Invalid ") + what + " at byte " + std::to_string(pos));
+        }
+
+        return value;
+    }
+}
+
+void classgraph::LayoutIO::read_json(std::istream &in) {
+    // Parse into the buffers of the input before last, swapped in only once all of it is accepted, so a throw leaves
+    // the current input and layout as they were. Append in chunks, which reuses their capacity
+    std::string& text = next_source;
+    text.clear();
+
+    std::array<char, 1 << 14> chunk;
+    while (in.read(chunk.data(), chunk.size()) || in.gcount() > 0) {
+        text.append(chunk.data(), static_cast<size_t>(in.gcount()));
+    }
+
+    // Validate without building a DOM, as SpanScanner relies on valid JSON
+    if (!nlohmann::json::accept(text)) {
+        throw std::runtime_error("Invalid JSON");
+    }
+
+    SpanScanner scanner { text };
+
+    if (!next_layout) {
+        next_layout.emplace(NodeInfo {}, Terms {});
+    }
+
+    // Fill the layout and spans in place, so reading many files reuses their buffers
+    auto& node_info = next_layout->node_info;
+    auto& terms = next_layout->terms;
+
+    std::fill(node_info.begin(), node_info.end(), Node(-1, 0, NO_CLASS_ID));
+    next_layout->waypoints.reset();
+
+    size_t terms_pos = require_array(text, require_key(scanner, text, scanner.skip_whitespace(0), "curriculum_terms"),
+                                     "curriculum_terms");
+
+    size_t term_count = 0;
+    scanner.for_each_element(terms_pos, [&] (size_t term_begin, size_t) {
+        if (term_count == MAX_TERMS) {
+            throw std::runtime_error("More than " + std::to_string(MAX_TERMS) + " terms");
+        }
+
+        if (terms.size() == term_count) {
+            terms.emplace_back();
+        }
+        if (next_item_spans.size() == term_count) {
+            next_item_spans.emplace_back();
+        }
+
+        auto& term = terms[term_count];
+        auto& spans = next_item_spans[term_count];
+        term.clear();
+        spans.clear();
+
+        size_t items_pos = require_array(text, require_key(scanner, text, term_begin, "curriculum_items"),
+                                         "curriculum_items");
+
+        scanner.for_each_element(items_pos, [&] (size_t item_begin, size_t item_end) {
+            int class_id = require_int(scanner, text, require_key(scanner, text, item_begin, "id"),
+                                       0, MAX_CLASS_ID - 1, "class ID");
+            if (node_info[class_id].class_id != NO_CLASS_ID) {
+                throw std::runtime_error("Duplicate class ID " + std::to_string(class_id));
+            }
+
+            Node& node = node_info[class_id];
+            node = Node { checked_int_cast<int8_t>(term_count),
+                          checked_int_cast<uint8_t>(term.size()),
+                          checked_int_cast<uint8_t>(class_id) };
+
+            size_t prereqs_pos = require_array(text, require_key(scanner, text, item_begin, "curriculum_requisites"),
+                                               "curriculum_requisites");
+
+            int prereq_i = 0;
+            scanner.for_each_element(prereqs_pos, [&] (size_t prereq_begin, size_t) {
+                if (prereq_i == MAX_PREREQS) {
+                    throw std::runtime_error("More than " + std::to_string(MAX_PREREQS) + " prereqs for class "
+                                             + std::to_string(class_id));
+                }
+
+                int source_id = require_int(scanner, text, require_key(scanner, text, prereq_begin, "source_id"),
+                                            0, MAX_CLASS_ID - 1, "source_id");
+                int target_id = require_int(scanner, text, require_key(scanner, text, prereq_begin, "target_id"),
+                                            0, MAX_CLASS_ID - 1, "target_id");
+
+                if (target_id != class_id) {
+                    throw std::runtime_error("Requisite of class " + std::to_string(class_id) + " targets "
+                                             + std::to_string(target_id));
+                }
+
+                node.prereqs[prereq_i++] = source_id;
+            });
+
+            term.push_back(class_id);
+            spans.push_back(Span { item_begin, item_end });
+        });
+
+        term_count++;
+    });
+
+    terms.resize(term_count);
+    next_item_spans.resize(term_count);
+
+    next_layout->compute_possible_intersections();
+
+    std::swap(source, next_source);
+    std::swap(item_spans, next_item_spans);
+    std::swap(read_layout, next_layout);
 }
 
 void classgraph::LayoutIO::read_json(const std::string &filename) {
     std::cout << "Reading file " << filename << "\n";
     std::ifstream in { filename };
-    assert(in.is_open());
+    if (!in.is_open()) {
+        throw std::runtime_error("Can't open " + filename);
+    }
 
     read_json(in);
 }
@@ -89,27 +273,74 @@ void classgraph::LayoutIO::write_new_layout(const classgraph::Layout &compatible
     write_new_layout(compatible, out);
 }
 
+bool classgraph::LayoutIO::write_new_layout_atomically(const classgraph::Layout &compatible, const std::string& filename) const {
+    std::string temporary = filename + ".tmp";
+
+    std::ofstream out { temporary };
+    if (!out.is_open()) {
+        return false;
+    }
+
+    write_new_layout(compatible, out);
+    out.flush();
+    out.close();
+
+    // Never replace the last good file with a partial one
+    std::error_code error;
+    if (out.fail()) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+
+    std::filesystem::rename(temporary, filename, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+
+    return true;
+}
+
 void classgraph::LayoutIO::write_new_layout(const classgraph::Layout &compatible, std::ostream &out) const {
     const auto& my_layout = read_layout.value();
     assert(my_layout.is_compatible_with(compatible));
 
-    const auto& my_json_terms = json.value()["curriculum_terms"];
+    size_t copied = 0;
+    auto copy_source = [&] (size_t until) {
+        out.write(source.data() + copied, static_cast<std::streamsize>(until - copied));
+        copied = until;
+    };
 
-    auto new_json = json.value();
-    auto new_json_terms = new_json["curriculum_terms"];
+    std::vector<const Span*> new_order;
 
     my_layout.for_each_term([&] (const auto& term, int term_i) {
-        int i = 0;
+        const auto& spans = item_spans.at(term_i);
+        if (spans.empty()) {
+            return;
+        }
+
+        // Items are in their original order in the input
+        new_order.assign(spans.size(), nullptr);
         for (ClassID id : term) {
-            // Find order of id in original
-            auto original_order = my_layout.get_class(id).order;
-            new_json_terms[i] = my_json_terms[original_order];
+            new_order.at(compatible.get_class(id).order) = &spans.at(my_layout.get_class(id).order);
+        }
+
+        copy_source(spans.front().begin);
 
-            i += 1;
+        for (size_t i = 0; i < spans.size(); ++i) {
+            if (i > 0) {
+                // Keep the original separator (comma and whitespace) at each position
+                out.write(source.data() + spans[i - 1].end, static_cast<std::streamsize>(spans[i].begin - spans[i - 1].end));
+            }
+
+            const Span* span = new_order[i];
+            out.write(source.data() + span->begin, static_cast<std::streamsize>(span->end - span->begin));
         }
+
+        copied = spans.back().end;
     });
 
-   out << new_json;
+    copy_source(source.size());
 }
 
 const classgraph::Layout& classgraph::LayoutIO::get_layout() const {
@@ -0,0 +1,408 @@
+#include "classgraph/Optimizer.h"
+#include "classgraph/FixedLayout.h"
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include <atomic>
+
+namespace classgraph {
+    Optimizer::Optimizer(const Layout& initial, OptimizerOptions options) : options(std::move(options)),
+        best(initial) {
+        if (best.get_intersection_storage() != this->options.storage) {
+            best.set_intersection_storage(this->options.storage);
+        }
+
+        best_value = best.evaluate();
+    }
+
+    std::vector<int> Optimizer::searched_terms() const {
+        if (options.active_terms) {
+            return *options.active_terms;
+        }
+
+        std::vector<int> terms(best.term_count());
+        std::iota(terms.begin(), terms.end(), 0);
+
+        return terms;
+    }
+
+    namespace {
+        // Same search as Optimizer::local_search, over positions of a FixedLayout. on_pass gets the score after each pass
+        template <int MaxTerms, int MaxPositions, typename OnPass>
+        ObjectiveValue local_search_fixed(FixedLayout<MaxTerms, MaxPositions>& layout, const std::vector<int>& terms,
+                                          const OptimizerOptions& options, OnPass&& on_pass) {
+            auto score = layout.evaluate();
+
+            for (int pass = 0; pass < options.max_passes; ++pass) {
+                bool improved = false;
+
+                for (int term_i : terms) {
+                    int size = layout.term_size(term_i);
+
+                    for (int i = 0; i < size; ++i) {
+                        for (int j = i + 1; j < size; ++j) {
+                            if (options.deadline.expired()) {
+                                return score;
+                            }
+
+                            auto candidate = score + layout.swap_delta(term_i, i, j);
+
+                            if (options.objective.better(candidate, score)) {
+                                layout.swap(term_i, i, j);
+                                score = candidate;
+                                improved = true;
+                            }
+                        }
+                    }
+                }
+
+                on_pass(score);
+                if (!improved || score == ObjectiveValue {}) {
+                    break;
+                }
+            }
+
+            return score;
+        }
+    }
+
+    bool Optimizer::checkpoint_due() const {
+        return options.checkpointer && options.checkpointer->due();
+    }
+
+    void Optimizer::checkpoint(const Layout& current, ObjectiveValue value) const {
+        options.checkpointer->checkpoint(options.objective.better(value, best_value) ? current : best);
+    }
+
+    ObjectiveValue Optimizer::local_search(Layout& layout, const std::vector<int>& terms) const {
+        ObjectiveValue score;
+        bool specialized = options.fixed_buckets && with_fixed_layout(layout, [&] (auto& fixed) {
+            score = local_search_fixed(fixed, terms, options, [&] (ObjectiveValue value) {
+                // A long search, or the only one with no restarts, still checkpoints as it goes
+                if (checkpoint_due()) {
+                    fixed.write_orders(layout);
+                    checkpoint(layout, value);
+                }
+            });
+            fixed.write_orders(layout);
+        });
+
+        if (specialized) {
+            return score;
+        }
+
+        score = layout.evaluate();
+
+        for (int pass = 0; pass < options.max_passes; ++pass) {
+            bool improved = false;
+
+            for (int term_i : terms) {
+                const auto& term = layout.get_terms().at(term_i);
+
+                for (size_t i = 0; i < term.size(); ++i) {
+                    for (size_t j = i + 1; j < term.size(); ++j) {
+                        // Each check guards a full evaluation, next to which reading the clock is cheap
+                        if (options.deadline.expired_now()) {
+                            return score;
+                        }
+
+                        auto& a = layout.get_class_mut(term[i]);
+                        auto& b = layout.get_class_mut(term[j]);
+
+                        layout.swap_nodes(a, b);
+                        auto candidate = layout.evaluate();
+
+                        if (options.objective.better(candidate, score)) {
+                            score = candidate;
+                            improved = true;
+                        } else {
+                            layout.swap_nodes(a, b);  // swapping again undoes it
+                        }
+                    }
+                }
+            }
+
+            if (checkpoint_due()) {
+                checkpoint(layout, score);
+            }
+            if (!improved || score == ObjectiveValue {}) {
+                break;
+            }
+        }
+
+        return score;
+    }
+
+    const Layout& Optimizer::optimize() {
+        auto terms = searched_terms();
+
+        Layout current = best;
+        best_value = local_search(current, terms);
+        best = current;
+
+        for (int restart = 0; restart < options.restarts; ++restart) {
+            if (best_value == ObjectiveValue {} || options.deadline.expired_now()) {
+                break;
+            }
+
+            if (options.checkpointer) {
+                options.checkpointer->offer(best);
+            }
+
+            current = best;
+            for (int term_i : terms) {
+                current.shuffle_term(term_i);
+            }
+            current.compute_possible_intersections();
+
+            auto value = local_search(current, terms);
+            if (options.objective.better(value, best_value)) {
+                best_value = value;
+                best = current;
+            }
+        }
+
+        return best;
+    }
+
+    namespace {
+        // Stack the given components in each term of layout, in the given order
+        void stack_components(Layout& layout, const std::vector<Layout>& components, const std::vector<int>& order) {
+            for (int term_i = 0; term_i < layout.term_count(); ++term_i) {
+                std::vector<ClassID> term;
+                for (int component : order) {
+                    auto part = components[component].ordered_term(term_i);
+                    term.insert(term.end(), part.begin(), part.end());
+                }
+
+                layout.set_term_order(term_i, term);
+            }
+
+            layout.compute_possible_intersections();
+        }
+    }
+
+    Layout optimize_components(const Layout& layout, const OptimizerOptions& options) {
+        std::vector<std::vector<ClassID>> groups;
+        std::vector<ClassID> isolated;
+
+        for (auto& component : layout.connected_components()) {
+            if (component.size() == 1) {
+                isolated.push_back(component[0]);
+            } else {
+                groups.push_back(std::move(component));
+            }
+        }
+
+        if (!isolated.empty()) {
+            groups.push_back(std::move(isolated));
+        }
+
+        std::vector<Layout> components;
+        for (const auto& group : groups) {
+            components.push_back(layout.sub_layout(group));
+        }
+
+        // Partial results aren't full layouts, so components can't be checkpointed
+        OptimizerOptions component_options = options;
+        component_options.checkpointer = nullptr;
+
+        // Components share nothing, so workers just pull the next unoptimized one
+        std::atomic<size_t> next_component = 0;
+        auto worker = [&] () {
+            for (size_t i; (i = next_component++) < components.size(); ) {
+                Optimizer optimizer { components[i], component_options };
+                components[i] = optimizer.optimize();
+            }
+        };
+
+        size_t worker_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), components.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < worker_count; ++i) {
+            workers.emplace_back(worker);
+        }
+
+        worker();
+        for (auto& thread : workers) {
+            thread.join();
+        }
+
+        // Insert the components one by one, largest first, wherever they cross the fewest connexions
+        std::vector<int> by_size(components.size());
+        std::iota(by_size.begin(), by_size.end(), 0);
+        std::stable_sort(by_size.begin(), by_size.end(), [&] (int a, int b) {
+            return groups[a].size() > groups[b].size();
+        });
+
+        std::vector<int> order;
+        std::vector<ClassID> inserted;
+
+        for (int component : by_size) {
+            inserted.insert(inserted.end(), groups[component].begin(), groups[component].end());
+            Layout partial = layout.sub_layout(inserted);
+
+            std::vector<int> best_order;
+            ObjectiveValue best_value;
+
+            for (size_t pos = 0; pos <= order.size(); ++pos) {
+                auto candidate = order;
+                candidate.insert(candidate.begin() + pos, component);
+
+                stack_components(partial, components, candidate);
+                auto value = partial.evaluate();
+
+                if (best_order.empty() || options.objective.better(value, best_value)) {
+                    best_order = std::move(candidate);
+                    best_value = value;
+                }
+            }
+
+            order = std::move(best_order);
+        }
+
+        Layout merged = layout;
+        stack_components(merged, components, order);
+
+        // Isolated classes and long connexions may still do better between the blocks, so polish the result,
+        // checkpointing the merged layout as it goes
+        if (options.checkpointer) {
+            options.checkpointer->offer(merged);
+        }
+
+        OptimizerOptions polish = options;
+        polish.restarts = 0;
+
+        return Optimizer { merged, polish }.optimize();
+    }
+
+    namespace {
+        std::vector<ClassID> sorted_prereqs(const Node& node) {
+            std::vector<ClassID> prereqs;
+            node.for_each_prereq([&] (ClassID prereq) {
+                prereqs.push_back(prereq);
+            });
+
+            std::sort(prereqs.begin(), prereqs.end());
+            return prereqs;
+        }
+    }
+
+    std::vector<int> warm_start(Layout& edited, const Layout& previous) {
+        std::vector<bool> affected(edited.term_count(), false);
+        std::vector<ClassID> inserted;
+
+        auto mark_class_term = [&] (ClassID id) {
+            if (edited.has_class(id)) {
+                affected.at(edited.get_class(id).term) = true;
+            }
+        };
+
+        // Terms at both ends of every connexion of id in layout, which is previous or edited
+        auto mark_connexion_terms = [&] (const Layout& layout, ClassID id) {
+            auto mark = [&] (ClassID end) {
+                if (layout.has_class(end) && layout.get_class(end).term < static_cast<int>(affected.size())) {
+                    affected[layout.get_class(end).term] = true;
+                }
+            };
+
+            mark(id);
+            layout.get_class(id).for_each_prereq(mark);
+            layout.for_each_class([&] (const Node& node) {
+                node.for_each_prereq([&] (ClassID prereq) {
+                    if (prereq == id) {
+                        mark(node.class_id);
+                    }
+                });
+            });
+        };
+
+        // A class which was added, removed or moved changes all its connexions, as they were and as they are
+        for (int id = 0; id < MAX_CLASS_ID; ++id) {
+            bool before = previous.has_class(id), now = edited.has_class(id);
+            if (before == now && (!now || previous.get_class(id).term == edited.get_class(id).term)) {
+                continue;
+            }
+
+            if (before) {
+                mark_connexion_terms(previous, id);
+            }
+            if (now) {
+                mark_connexion_terms(edited, id);
+            }
+        }
+
+        for (int term_i = 0; term_i < edited.term_count(); ++term_i) {
+            const auto& term = edited.get_terms()[term_i];
+            std::vector<ClassID> kept, new_in_term;
+
+            for (ClassID id : term) {
+                if (previous.has_class(id) && previous.get_class(id).term == term_i) {
+                    kept.push_back(id);
+                } else {
+                    new_in_term.push_back(id);
+                }
+            }
+
+            // Changed prereqs add or remove connexions, affecting both ends
+            for (ClassID id : kept) {
+                auto now = sorted_prereqs(edited.get_class(id)), before = sorted_prereqs(previous.get_class(id));
+                if (now == before) {
+                    continue;
+                }
+
+                affected[term_i] = true;
+
+                std::vector<ClassID> changed;
+                std::set_symmetric_difference(now.begin(), now.end(), before.begin(), before.end(),
+                                              std::back_inserter(changed));
+                std::for_each(changed.begin(), changed.end(), mark_class_term);
+            }
+
+            std::sort(kept.begin(), kept.end(), [&] (ClassID a, ClassID b) {
+                return previous.get_class(a).order < previous.get_class(b).order;
+            });
+
+            kept.insert(kept.end(), new_in_term.begin(), new_in_term.end());
+            edited.set_term_order(term_i, kept);
+
+            inserted.insert(inserted.end(), new_in_term.begin(), new_in_term.end());
+        }
+
+        edited.compute_possible_intersections();
+
+        // Bubble each inserted class up to the top of its term, then back down to the best position seen
+        for (ClassID id : inserted) {
+            auto& node = edited.get_class_mut(id);
+            auto order = edited.ordered_term(node.term);
+
+            int pos = node.order;
+            int best_pos = pos;
+            auto best_score = edited.count_crossings();
+
+            for (; pos > 0; --pos) {
+                edited.swap_nodes(node, edited.get_class_mut(order[pos - 1]));
+                std::swap(order[pos], order[pos - 1]);
+
+                auto score = edited.count_crossings();
+                if (score < best_score) {
+                    best_score = score;
+                    best_pos = pos - 1;
+                }
+            }
+
+            for (; pos < best_pos; ++pos) {
+                edited.swap_nodes(node, edited.get_class_mut(order[pos + 1]));
+                std::swap(order[pos], order[pos + 1]);
+            }
+        }
+
+        std::vector<int> affected_terms;
+        for (int term_i = 0; term_i < affected.size(); ++term_i) {
+            if (affected[term_i]) {
+                affected_terms.push_back(term_i);
+            }
+        }
+
+        return affected_terms;
+    }
+}
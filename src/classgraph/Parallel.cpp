@@ -0,0 +1,131 @@
+#include "classgraph/Parallel.h"
+#include <atomic>
+
+namespace classgraph {
+    namespace {
+        // Intersections per chunk: 32 KiB, about an L1 data cache
+        constexpr size_t CHUNK_SIZE = 4096;
+
+        // Per worker result on its own cache line
+        struct alignas(64) PartialCount {
+            IntersectionCounters counters;
+        };
+    }
+
+    WorkerPool::WorkerPool(unsigned workers) {
+        for (unsigned worker = 1; worker < workers; ++worker) {
+            threads.emplace_back([this, worker] { work(worker); });
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard lock { mutex };
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::work(unsigned worker) {
+        uint64_t seen = 0;
+
+        while (true) {
+            const std::function<void(unsigned)>* current;
+            {
+                std::unique_lock lock { mutex };
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+
+                if (stopping) {
+                    return;
+                }
+
+                seen = generation;
+                current = job;
+            }
+
+            (*current)(worker);
+
+            {
+                std::lock_guard lock { mutex };
+                if (--pending == 0) {
+                    finished.notify_one();
+                }
+            }
+        }
+    }
+
+    void WorkerPool::run(const std::function<void(unsigned)>& new_job) {
+        std::unique_lock busy { running, std::try_to_lock };
+        if (!busy.owns_lock() || threads.empty()) {
+            new_job(0);
+            return;
+        }
+
+        {
+            std::lock_guard lock { mutex };
+            job = &new_job;
+            pending = static_cast<unsigned>(threads.size());
+            generation++;
+        }
+        wake.notify_all();
+
+        new_job(0);
+
+        std::unique_lock lock { mutex };
+        finished.wait(lock, [&] { return pending == 0; });
+        job = nullptr;
+    }
+
+    WorkerPool& WorkerPool::shared() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    IntersectionCounters count_intersections_parallel(const uint64_t* begin, const uint64_t* end,
+                                                      WorkerPool* pool_or_shared) {
+        static_assert(sizeof(Intersection) == sizeof(uint64_t));
+
+        // Small inputs never start the shared pool's threads
+        if (static_cast<size_t>(end - begin) < kernel_tuning.parallel_count_min) {
+            return count_intersections(begin, end);
+        }
+
+        WorkerPool& pool = pool_or_shared ? *pool_or_shared : WorkerPool::shared();
+        if (pool.size() == 1) {
+            return count_intersections(begin, end);
+        }
+
+        // Chunks start on cache lines, so the aligned loads never straddle two and no line is split between workers
+        auto* first = reinterpret_cast<const uint64_t*>((reinterpret_cast<uintptr_t>(begin) + 63) & ~uintptr_t { 63 });
+        first = std::min(first, end);
+
+        size_t chunks = (end - first + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        std::atomic<size_t> next_chunk = 0;
+        std::vector<PartialCount> partial(pool.size());
+
+        pool.run([&] (unsigned worker) {
+            IntersectionCounters counters;
+            if (worker == 0) {
+                counters += count_intersections(begin, first);
+            }
+
+            for (size_t chunk; (chunk = next_chunk.fetch_add(1, std::memory_order_relaxed)) < chunks;) {
+                const uint64_t* chunk_begin = first + chunk * CHUNK_SIZE;
+                counters += count_intersections(chunk_begin, std::min(chunk_begin + CHUNK_SIZE, end));
+            }
+
+            partial[worker].counters = counters;
+        });
+
+        IntersectionCounters result;
+        for (const auto& part : partial) {
+            result += part.counters;
+        }
+
+        return result;
+    }
+}
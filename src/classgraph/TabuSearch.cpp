@@ -0,0 +1,178 @@
+#include "classgraph/TabuSearch.h"
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+
+namespace classgraph {
+    TabuSearch::TabuSearch(const Layout& initial, TabuOptions options) : options(options), layout(initial),
+        initial_storage(initial.get_intersection_storage()) {
+        layout.set_intersection_storage(IntersectionStorage::ClassIDs);
+
+        intersections_of.resize(NO_CLASS_ID + 1);
+        related.resize(NO_CLASS_ID + 1);
+
+        const auto& intersections = layout.get_indexed_intersections();
+        for (uint32_t i = 0; i < intersections.size(); ++i) {
+            const auto& inter = intersections[i];
+            ClassID ids[4] = { inter.a, inter.b, inter.c, inter.d };
+
+            for (ClassID id : ids) {
+                intersections_of[id].push_back(i);
+                for (ClassID other : ids) {
+                    related[id].set(other);
+                }
+            }
+        }
+
+        connexions_of.resize(NO_CLASS_ID + 1);
+
+        const auto& ends = layout.get_connexion_ends();
+        for (uint32_t i = 0; i < ends.size(); ++i) {
+            auto [from, to] = ends[i];
+            connexions_of[from].push_back(i);
+            connexions_of[to].push_back(i);
+
+            // Moving either end changes the length delta of swapping the other
+            related[from].set(to);
+            related[to].set(from);
+        }
+
+        std::vector<int> terms(layout.term_count());
+        std::iota(terms.begin(), terms.end(), 0);
+
+        for (int term_i : options.active_terms.value_or(terms)) {
+            const auto& term = layout.get_terms()[term_i];
+            for (size_t i = 0; i < term.size(); ++i) {
+                for (size_t j = i + 1; j < term.size(); ++j) {
+                    moves.push_back(Move { term[i], term[j], swap_delta(term[i], term[j]), 0 });
+                }
+            }
+        }
+
+        save_best(layout.evaluate());
+    }
+
+    ObjectiveValue TabuSearch::swap_delta(ClassID a, ClassID b) const {
+        const auto& intersections = layout.get_indexed_intersections();
+
+        const auto& positions = layout.get_positions();
+
+        auto before = [&] (ClassID id) {
+            return positions[id].point();
+        };
+        auto after = [&] (ClassID id) {
+            return positions[id == a ? b : id == b ? a : id].point();
+        };
+
+        IntersectionCounters crossings;
+        auto add = [&] (const IndexedIntersection& inter) {
+            crossings += intersects(after(inter.a), after(inter.b), after(inter.c), after(inter.d))
+                - intersects(before(inter.a), before(inter.b), before(inter.c), before(inter.d));
+        };
+
+        for (uint32_t i : intersections_of[a]) {
+            add(intersections[i]);
+        }
+
+        // Intersections involving both were already counted
+        for (uint32_t i : intersections_of[b]) {
+            const auto& inter = intersections[i];
+            if (inter.a != a && inter.b != a && inter.c != a && inter.d != a) {
+                add(inter);
+            }
+        }
+
+        const auto& ends = layout.get_connexion_ends();
+        int length = 0;
+
+        auto add_length = [&] (uint32_t i) {
+            auto [from, to] = ends[i];
+            length += std::abs(after(from).y - after(to).y) - std::abs(before(from).y - before(to).y);
+        };
+
+        std::for_each(connexions_of[a].begin(), connexions_of[a].end(), add_length);
+        for (uint32_t i : connexions_of[b]) {
+            if (ends[i].first != a && ends[i].second != a) {
+                add_length(i);
+            }
+        }
+
+        return { crossings, length };
+    }
+
+    void TabuSearch::save_best(ObjectiveValue value) {
+        best_value = value;
+        layout.for_each_class([&] (const Node& node) {
+            best_orders[node.class_id] = node.order;
+        });
+    }
+
+    Layout TabuSearch::optimize() {
+        const auto& objective = options.objective;
+        auto current = best_value;
+
+        for (int iteration = 0; iteration < options.iterations; ++iteration) {
+            // Each iteration scans every move, so read the clock every time
+            if (best_value == ObjectiveValue {} || options.deadline.expired_now()) {
+                break;
+            }
+
+            if (options.checkpointer && options.checkpointer->due()) {
+                options.checkpointer->checkpoint(best_layout());
+            }
+
+            Move* chosen = nullptr;
+            for (auto& move : moves) {
+                bool aspirated = objective.better(current + move.delta, best_value);
+                if (move.tabu_until > iteration && !aspirated) {
+                    continue;
+                }
+
+                if (!chosen || objective.better(move.delta, chosen->delta)) {
+                    chosen = &move;
+                }
+            }
+
+            if (!chosen) {
+                break;
+            }
+
+            ClassID a = chosen->a, b = chosen->b;
+
+            layout.swap_nodes(layout.get_class_mut(a), layout.get_class_mut(b));
+            current = current + chosen->delta;
+            chosen->tabu_until = iteration + options.tenure;
+
+            if (objective.better(current, best_value)) {
+                save_best(current);
+            }
+
+            // Only swaps of a, b, or classes sharing an intersection or connexion with them can have changed
+            auto dirty = related[a] | related[b];
+            dirty.set(a);
+            dirty.set(b);
+            for (auto& move : moves) {
+                if (dirty[move.a] || dirty[move.b]) {
+                    move.delta = swap_delta(move.a, move.b);
+                }
+            }
+        }
+
+        return best_layout();
+    }
+
+    Layout TabuSearch::best_layout() const {
+        Layout best = layout;
+        for (int term_i = 0; term_i < static_cast<int>(best.term_count()); ++term_i) {
+            auto term = best.get_terms()[term_i];
+            std::sort(term.begin(), term.end(), [&] (ClassID x, ClassID y) {
+                return best_orders[x] < best_orders[y];
+            });
+
+            best.set_term_order(term_i, term);
+        }
+
+        best.set_intersection_storage(initial_storage);
+        return best;
+    }
+}
@@ -1,7 +1,12 @@
 
+#include "classgraph/KernelTuning.h"
 #include "classgraph/Layout.h"
 #include "classgraph/LayoutIO.h"
+#include "classgraph/Optimizer.h"
+#include "classgraph/TabuSearch.h"
 #include <iostream>
+#include <chrono>
+#include <optional>
 
 #include <cxxopts.hpp>
 
@@ -11,14 +16,124 @@ int main(int argc, char** argv) {
     cxxopts::Options options { "ClassGraphOptimizer", "Optimize ordering of class data" };
     options.add_options()
             ("in_file", "Input file", cxxopts::value<std::string>())
-            ("out_file", "Output path (default: out.json)", cxxopts::value<std::string>()->default_value("./out.json"));
+            ("out_file", "Output path (default: out.json)", cxxopts::value<std::string>()->default_value("./out.json"))
+            ("previous", "Previously optimized output for an earlier version of in_file; only terms affected by the edits are searched again",
+                cxxopts::value<std::string>())
+            ("restarts", "Number of shuffled restarts", cxxopts::value<int>()->default_value("16"))
+            ("indexed", "Store intersections as class IDs into a position table, making swaps constant time")
+            ("waypoints", "Route prereqs spanning several terms through virtual nodes in the terms between, which are ordered too")
+            ("components", "Optimize connected components separately, in parallel")
+            ("tabu", "Use tabu search for the given number of iterations instead of random restarts",
+                cxxopts::value<int>())
+            ("objective", "lexicographic (crossings, then edge length) or weighted",
+                cxxopts::value<std::string>()->default_value("lexicographic"))
+            ("length-weight", "Weight of the total edge length in the weighted objective",
+                cxxopts::value<double>()->default_value("0.05"))
+            ("time-limit", "Stop searching after this many milliseconds and write the best layout found",
+                cxxopts::value<int>())
+            ("checkpoint", "Periodically write the best layout so far to this file, atomically; SIGUSR1 forces a write",
+                cxxopts::value<std::string>())
+            ("checkpoint-interval", "Milliseconds between checkpoints",
+                cxxopts::value<int>()->default_value("1000"))
+            ("calibrate", "Time the kernel variants on this machine, save the chosen thresholds to the tuning file and exit")
+            ("tuning-file", "Kernel thresholds written by --calibrate, loaded at startup if present",
+                cxxopts::value<std::string>()->default_value("./classgraph_tuning.txt"));
 
     options.parse_positional({ "in_file", "out_file" });
 
     auto result = options.parse(argc, argv);
+
+    auto tuning_file = result["tuning-file"].as<std::string>();
+    if (result.count("calibrate")) {
+        kernel_tuning = calibrate_kernels();
+        save_kernel_tuning(kernel_tuning, tuning_file);
+
+        std::cout << "Calibrated " << kernel_tuning << ", saved to " << tuning_file << "\n";
+        return 0;
+    }
+
+    load_kernel_tuning(kernel_tuning, tuning_file);
+
     auto in = result["in_file"].as<std::string>();
     auto out = result["out_file"].as<std::string>();
 
     LayoutIO io;
     io.read_json(in);
-}
\ No newline at end of file
+
+    Layout layout = io.get_layout();
+    OptimizerOptions optimizer_options;
+    optimizer_options.restarts = result["restarts"].as<int>();
+    if (result.count("indexed")) {
+        optimizer_options.storage = IntersectionStorage::ClassIDs;
+    }
+
+    auto& objective = optimizer_options.objective;
+    objective.length_weight = result["length-weight"].as<double>();
+
+    auto objective_mode = result["objective"].as<std::string>();
+    if (objective_mode == "weighted") {
+        objective.mode = Objective::Mode::Weighted;
+    } else if (objective_mode != "lexicographic") {
+        std::cerr << "Unknown objective " << objective_mode << "\n";
+        return 1;
+    }
+
+    if (result.count("time-limit")) {
+        optimizer_options.deadline = Deadline::after(std::chrono::milliseconds { result["time-limit"].as<int>() });
+    }
+
+    std::optional<Checkpointer> checkpointer;
+    if (result.count("checkpoint")) {
+        auto checkpoint_file = result["checkpoint"].as<std::string>();
+        auto interval = std::chrono::milliseconds { result["checkpoint-interval"].as<int>() };
+
+        checkpointer.emplace([&io, checkpoint_file] (const Layout& best) {
+            // A failed checkpoint keeps the previous one; the search goes on
+            if (!io.write_new_layout_atomically(best.without_waypoints(), checkpoint_file)) {
+                std::cerr << "Failed to write checkpoint " << checkpoint_file << "\n";
+            }
+        }, interval);
+
+        optimizer_options.checkpointer = &*checkpointer;
+        install_checkpoint_signal();
+    }
+
+    if (result.count("previous")) {
+        LayoutIO previous;
+        previous.read_json(result["previous"].as<std::string>());
+
+        optimizer_options.active_terms = warm_start(layout, previous.get_layout());
+        optimizer_options.restarts = 0;  // stay close to the previous layout
+
+        std::cout << "Warm start affects " << optimizer_options.active_terms->size() << " terms\n";
+    }
+
+    if (result.count("waypoints")) {
+        layout = layout.with_waypoints();
+    }
+
+    Layout best = layout;
+    if (result.count("tabu")) {
+        TabuOptions tabu_options;
+        tabu_options.iterations = result["tabu"].as<int>();
+        tabu_options.active_terms = optimizer_options.active_terms;
+        tabu_options.objective = objective;
+        tabu_options.deadline = optimizer_options.deadline;
+        tabu_options.checkpointer = optimizer_options.checkpointer;
+
+        best = TabuSearch { layout, tabu_options }.optimize();
+    } else if (result.count("components")) {
+        best = optimize_components(layout, optimizer_options);
+    } else {
+        best = Optimizer { layout, optimizer_options }.optimize();
+    }
+
+    best = best.without_waypoints();
+
+    std::cout << "Best layout: " << best.evaluate() << "\n";
+    io.write_new_layout(best, out);
+
+    if (checkpointer) {
+        checkpointer->checkpoint(best);
+    }
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <ostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace classgraph {
+    /**
+     * Hardware counters for the calling thread via perf_event_open. The counters are opened as one group, so they are
+     * enabled, disabled and read together and cover the same instructions; if the kernel multiplexes the group with
+     * other events, counts are scaled up by the time it was enabled over the time it ran. Counters which can't be
+     * opened (no permission, virtualized PMU, not Linux) are reported as missing rather than failing; wall-clock time
+     * is always measured.
+     */
+    class PerfCounters {
+    public:
+        enum Event { Cycles, Instructions, CacheMisses, BranchMisses, EventCount };
+
+        struct Sample {
+            std::array<std::optional<uint64_t>, EventCount> counts{};
+            double nanoseconds{};
+        };
+
+    private:
+        std::array<int, EventCount> fds{};
+        // Index of each counter's value in a read of the group, in the order they joined it
+        std::array<int, EventCount> slots{};
+        // First counter opened, or -1 if none could be
+        int leader = -1;
+        int members = 0;
+        std::chrono::steady_clock::time_point started{};
+
+#ifdef __linux__
+        static int open_counter(uint64_t config, int group_fd) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = config;
+            // Members count whenever the leader does
+            attr.disabled = group_fd < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+        }
+#endif
+
+    public:
+        PerfCounters() {
+            fds.fill(-1);
+            slots.fill(-1);
+#ifdef __linux__
+            const uint64_t configs[EventCount] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+            for (int i = 0; i < EventCount; ++i) {
+                fds[i] = open_counter(configs[i], leader);
+                if (fds[i] < 0) {
+                    continue;
+                }
+
+                if (leader < 0) {
+                    leader = fds[i];
+                }
+                slots[i] = members++;
+            }
+#endif
+        }
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        ~PerfCounters() {
+#ifdef __linux__
+            for (int fd : fds) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+#endif
+        }
+
+        bool available(Event event) const {
+            return fds[event] >= 0;
+        }
+
+        void start() {
+#ifdef __linux__
+            if (leader >= 0) {
+                ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+#endif
+            started = std::chrono::steady_clock::now();
+        }
+
+        Sample stop() {
+            Sample sample;
+            sample.nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+
+#ifdef __linux__
+            if (leader < 0) {
+                return sample;
+            }
+
+            ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+            // Number of values, time enabled, time running, then one value per member
+            std::array<uint64_t, 3 + EventCount> data{};
+            auto expected = static_cast<ssize_t>((3 + members) * sizeof(uint64_t));
+
+            // A group that never got scheduled on the PMU counted nothing worth scaling
+            if (read(leader, data.data(), sizeof(data)) < expected || data[2] == 0) {
+                return sample;
+            }
+
+            double scale = static_cast<double>(data[1]) / static_cast<double>(data[2]);
+            for (int i = 0; i < EventCount; ++i) {
+                if (slots[i] >= 0) {
+                    sample.counts[i] = static_cast<uint64_t>(static_cast<double>(data[3 + slots[i]]) * scale + 0.5);
+                }
+            }
+#endif
+            return sample;
+        }
+
+        /**
+         * Run fn iterations times under the counters and print one line of per-element figures, where each call
+         * processes elements elements
+         */
+        template <typename Fn>
+        void report(std::ostream& out, const std::string& label, size_t elements, int iterations, Fn&& fn) {
+            fn();  // warm up caches and page in the input
+
+            start();
+            for (int i = 0; i < iterations; ++i) {
+                fn();
+            }
+            auto sample = stop();
+
+            double total = static_cast<double>(elements) * iterations;
+            auto per_element = [&] (Event event) -> std::string {
+                if (!sample.counts[event]) {
+                    return "n/a";
+                }
+                std::ostringstream s;
+                s << std::fixed << std::setprecision(3) << *sample.counts[event] / total;
+                return s.str();
+            };
+
+            std::string ipc = "n/a";
+            if (sample.counts[Cycles] && sample.counts[Instructions] && *sample.counts[Cycles] > 0) {
+                std::ostringstream s;
+                s << std::fixed << std::setprecision(2)
+                  << static_cast<double>(*sample.counts[Instructions]) / *sample.counts[Cycles];
+                ipc = s.str();
+            }
+
+            auto flags = out.flags();
+            out << std::left << std::setw(48) << label
+                << " ns/elem " << std::setw(8) << std::fixed << std::setprecision(3) << sample.nanoseconds / total
+                << " cycles/elem " << std::setw(8) << per_element(Cycles)
+                << " IPC " << std::setw(6) << ipc
+                << " cache-miss/elem " << std::setw(8) << per_element(CacheMisses)
+                << " branch-miss/elem " << per_element(BranchMisses) << "\n";
+            out.flags(flags);
+        }
+    };
+}
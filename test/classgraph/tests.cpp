@@ -2,14 +2,175 @@
 #include <catch2/matchers/catch_matchers_vector.hpp>
 #include <catch2/benchmark/catch_benchmark_all.hpp>
 #include "classgraph/Layout.h"
+#include "classgraph/LayoutIO.h"
 #include "classgraph/Swaps.h"
+#include "classgraph/Optimizer.h"
+#include "classgraph/TabuSearch.h"
+#include "classgraph/KernelTuning.h"
+#include "classgraph/Parallel.h"
+#include "classgraph/FixedLayout.h"
+#include "PerfCounters.h"
 
+#include <atomic>
+#include <csignal>
+#include <filesystem>
 #include <fstream>
+#include <sstream>
 
 using namespace classgraph;
 
+namespace {
+    // Three terms of crossing connexions, small enough to reason about by hand
+    const std::string SAMPLE_GRAPH =
+        "3\n"
+        "0 4 0 0 1 0 2 0 3 0\n"
+        "1 4 4 2 0 3 5 1 1 6 2 2 0 7 1 3\n"
+        "2 3 8 2 4 7 9 1 5 10 2 6 4\n";
+
+    Layout sample_layout() {
+        return Layout::parse(SAMPLE_GRAPH);
+    }
+
+    // Deterministic LCG, so failures reproduce
+    struct TestRng {
+        uint64_t state;
+
+        uint64_t operator()() {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+
+            return state >> 33;
+        }
+    };
+
+    /**
+     * Random layout of term_count terms of 1 to max_classes classes each. Every class requires each earlier class
+     * with probability 1 / prereq_one_in, up to MAX_PREREQS; with adjacent_only, only classes of the previous term.
+     */
+    Layout random_layout(TestRng& rng, int term_count, int max_classes, int prereq_one_in, bool adjacent_only) {
+        std::ostringstream text;
+        text << term_count << "\n";
+
+        int next_id = 0, prereqs_first = 0;
+        for (int term_i = 0; term_i < term_count; ++term_i) {
+            int count = 1 + rng() % max_classes;
+            text << term_i << " " << count << "\n";
+
+            for (int j = 0; j < count; ++j) {
+                std::vector<int> prereqs;
+                for (int k = prereqs_first; k < next_id && prereqs.size() < MAX_PREREQS; ++k) {
+                    if (rng() % prereq_one_in == 0) {
+                        prereqs.push_back(k);
+                    }
+                }
+
+                text << next_id + j << " " << prereqs.size();
+                for (int prereq : prereqs) {
+                    text << " " << prereq;
+                }
+                text << "\n";
+            }
+
+            if (adjacent_only) {
+                prereqs_first = next_id;
+            }
+            next_id += count;
+        }
+
+        return Layout::parse(text.str());
+    }
+}
+
 TEST_CASE("Layout read/write") {
+    const std::string input = R"({
+  "name": "Test [curriculum]",
+  "curriculum_terms": [
+    {
+      "name": "Term 1",
+      "curriculum_items": [
+        { "curriculum_requisites": [], "name": "A \"intro\"", "id": 1 },
+        { "curriculum_requisites": [], "name": "B", "id": 2 },
+        { "curriculum_requisites": [], "name": "C", "id": 3 }
+      ],
+      "id": 1
+    },
+    {
+      "name": "Term 2",
+      "curriculum_items": [
+        {
+          "curriculum_requisites": [ { "source_id": 3, "target_id": 4 } ],
+          "name": "D",
+          "id": 4
+        },
+        { "curriculum_requisites": [ { "source_id": 1, "target_id": 5 } ], "name": "E", "id": 5 }
+      ],
+      "id": 2
+    },
+    { "name": "Term 3", "curriculum_items": [], "id": 3 }
+  ],
+  "metrics": { "complexity": 5 }
+})";
 
+    std::istringstream in { input };
+    LayoutIO io;
+    io.read_json(in);
+
+    const auto& layout = io.get_layout();
+    REQUIRE(io.term_count() == 3);
+    REQUIRE(layout.get_class(4).prereqs[0] == 3);
+    REQUIRE(layout.count_crossings() == IntersectionCounters { 1, 1 });
+
+    Layout reordered = layout;
+    reordered.set_term_order(0, { 3, 1, 2 });
+    reordered.set_term_order(1, { 5, 4 });
+
+    std::ostringstream out;
+    io.write_new_layout(reordered, out);
+
+    auto written = nlohmann::json::parse(out.str());
+    auto original = nlohmann::json::parse(input);
+
+    auto names = [] (const nlohmann::json& term) {
+        std::vector<std::string> names;
+        for (const auto& item : term["curriculum_items"]) {
+            names.push_back(item["name"].get<std::string>());
+        }
+        return names;
+    };
+
+    REQUIRE_THAT(names(written["curriculum_terms"][0]), Catch::Matchers::Equals(std::vector<std::string> { "C", "A \"intro\"", "B" }));
+    REQUIRE_THAT(names(written["curriculum_terms"][1]), Catch::Matchers::Equals(std::vector<std::string> { "E", "D" }));
+    REQUIRE(written["curriculum_terms"][1]["curriculum_items"][1] == original["curriculum_terms"][1]["curriculum_items"][0]);
+    REQUIRE(written["metrics"] == original["metrics"]);
+
+    // Nothing else changes, so writing the original order reproduces the input exactly
+    std::ostringstream same;
+    io.write_new_layout(layout, same);
+    REQUIRE(same.str() == input);
+
+    // Reading the output back gives the new order
+    std::istringstream written_in { out.str() };
+    LayoutIO reread;
+    reread.read_json(written_in);
+    REQUIRE(reread.get_layout().ordered_term(0) == std::vector<ClassID> { 3, 1, 2 });
+
+    // Atomic writes leave nothing behind when they fail, and only the finished file when they succeed
+    REQUIRE_FALSE(io.write_new_layout_atomically(reordered, "no_such_directory/out.json"));
+
+    std::filesystem::create_directory("atomic_write_test");
+    std::ofstream { "atomic_write_test/keep" } << "x";
+
+    REQUIRE_FALSE(io.write_new_layout_atomically(reordered, "atomic_write_test"));  // can't replace a directory
+    REQUIRE_FALSE(std::filesystem::exists("atomic_write_test.tmp"));
+    REQUIRE(std::filesystem::exists("atomic_write_test/keep"));
+    std::filesystem::remove_all("atomic_write_test");
+
+    REQUIRE(io.write_new_layout_atomically(reordered, "atomic_write_test.json"));
+    REQUIRE_FALSE(std::filesystem::exists("atomic_write_test.json.tmp"));
+
+    std::ifstream atomic_in { "atomic_write_test.json" };
+    std::string atomic_text { std::istreambuf_iterator<char>(atomic_in), std::istreambuf_iterator<char>() };
+    REQUIRE(atomic_text == out.str());
+    std::filesystem::remove("atomic_write_test.json");
 }
 
 TEST_CASE("Swap benchmarks") {
@@ -85,6 +246,71 @@ TEST_CASE("Swap benchmarks") {
     CREATE_2BENCHMARKS(8192, "8192")
     CREATE_2BENCHMARKS(16384, "16384")
 
+#undef CREATE_BENCHMARK
+#undef CREATE_2BENCHMARKS
+
+    PositionTable positions;
+    for (int i = 0; i < positions.size(); ++i) {
+        positions[i] = SmallPoint { static_cast<uint8_t>(i % 12), static_cast<uint8_t>(i / 12) };
+    }
+
+#define CREATE_BENCHMARK(size_, size_label, native, native_label) \
+    BENCHMARK("count_intersections_indexed, size " size_label ", native " native_label) { \
+      auto& c = create_u8(size_); \
+      return count_intersections_indexed<native>((const uint32_t*)c.data(), (const uint32_t*)(c.data() + c.size()), \
+          positions.data()); \
+  };
+#define CREATE_2BENCHMARKS(size_, size_label) \
+    CREATE_BENCHMARK(size_, size_label, false, "no") \
+    CREATE_BENCHMARK(size_, size_label, true, "yes")
+
+    CREATE_2BENCHMARKS(64, "64")
+    CREATE_2BENCHMARKS(1024, "1024")
+    CREATE_2BENCHMARKS(16384, "16384")
+
+#undef CREATE_BENCHMARK
+#undef CREATE_2BENCHMARKS
+}
+
+// Hidden; run with [perf]. Prints cycles, IPC, cache and branch misses per element of each kernel
+TEST_CASE("Kernel performance counters", "[.][perf]") {
+    PerfCounters counters;
+    if (!counters.available(PerfCounters::Cycles)) {
+        WARN("Hardware counters unavailable, reporting wall-clock time only");
+    }
+
+    for (int size : { 8, 16, 32, 64, 128, 256, 1024, 4096, 16384, 65536 }) {
+        std::vector<uint16_t> points(size);
+        for (int i = 0; i < size; ++i) {
+            points[i] = i % 5;
+        }
+
+        int iterations = std::max(10, (1 << 22) / size);
+        std::string size_label = ", size " + std::to_string(size);
+
+        counters.report(std::cout, "swap_small_points, native no" + size_label, size, iterations, [&] {
+            swap_small_points_vector<false>(points, 2, 3);
+        });
+        counters.report(std::cout, "swap_small_points, native yes" + size_label, size, iterations, [&] {
+            swap_small_points_vector<true>(points, 2, 3);
+        });
+
+        // Same bytes viewed as intersections, four points each
+        std::vector<uint8_t> pairs(size * 2);
+        for (int i = 0; i < pairs.size(); ++i) {
+            pairs[i] = i % 5;
+        }
+
+        IntersectionCounters sink;
+        counters.report(std::cout, "count_intersections, native no" + size_label, size / 4, iterations, [&] {
+            sink += count_intersections<false>(pairs);
+        });
+        counters.report(std::cout, "count_intersections, native yes" + size_label, size / 4, iterations, [&] {
+            sink += count_intersections<true>(pairs);
+        });
+
+        REQUIRE(sink.proper >= 0);
+    }
 }
 
 TEST_CASE("Swaps") {
@@ -160,3 +386,700 @@ TEST_CASE("Swaps") {
 
 }
 
+
+TEST_CASE("Optimizer") {
+    // Two terms whose connexions form an X; uncrossing it needs a single swap
+    std::istringstream x_shape {
+        "2\n"
+        "0 2 0 0 1 0\n"
+        "1 2 2 1 1 3 1 0\n"
+    };
+
+    Layout layout = Layout::read(x_shape);
+    REQUIRE(layout.count_crossings() == IntersectionCounters { 1, 1 });
+
+    Optimizer optimizer { layout };
+    const auto& best = optimizer.optimize();
+
+    REQUIRE(optimizer.get_best_score() == IntersectionCounters { 0, 0 });
+    REQUIRE(best.count_crossings() == IntersectionCounters { 0, 0 });
+    REQUIRE(best.is_compatible_with(layout));
+}
+
+TEST_CASE("Warm start") {
+    std::istringstream original_in {
+        "3\n"
+        "0 3 0 0 1 0 2 0\n"
+        "1 3 3 1 0 4 1 1 5 1 2\n"
+        "2 2 6 1 3 7 1 5\n"
+    };
+
+    Layout original = Layout::read(original_in);
+    Optimizer optimizer { original };
+    Layout previous = optimizer.optimize();
+
+    // Add class 8 in the last term, requiring class 4
+    std::istringstream edited_in {
+        "3\n"
+        "0 3 0 0 1 0 2 0\n"
+        "1 3 3 1 0 4 1 1 5 1 2\n"
+        "2 3 6 1 3 7 1 5 8 1 4\n"
+    };
+
+    Layout edited = Layout::read(edited_in);
+    auto affected = warm_start(edited, previous);
+
+    REQUIRE_THAT(affected, Catch::Matchers::Equals(std::vector<int> { 1, 2 }));
+
+    // Existing classes keep their relative order
+    for (int term_i = 0; term_i < 3; ++term_i) {
+        auto before = previous.ordered_term(term_i);
+        auto after = edited.ordered_term(term_i);
+        after.erase(std::remove(after.begin(), after.end(), 8), after.end());
+
+        REQUIRE_THAT(after, Catch::Matchers::Equals(before));
+    }
+
+    // The new class was put in the best place it could go
+    auto best = edited.count_crossings();
+    auto without_new = previous.ordered_term(2);
+
+    for (int pos = 0; pos <= without_new.size(); ++pos) {
+        auto order = without_new;
+        order.insert(order.begin() + pos, 8);
+
+        Layout candidate = edited;
+        candidate.set_term_order(2, order);
+        candidate.compute_possible_intersections();
+
+        REQUIRE_FALSE(candidate.count_crossings() < best);
+    }
+
+    // Class 1 moves from term 1 to term 2, so its connexion to class 4 in term 3 changes too
+    Layout before_move = Layout::parse("4\n0 1 0 0\n1 2 1 1 0 2 0\n2 1 3 0\n3 1 4 1 1\n");
+    Layout moved = Layout::parse("4\n0 1 0 0\n1 1 2 0\n2 2 3 0 1 1 0\n3 1 4 1 1\n");
+    REQUIRE_THAT(warm_start(moved, before_move), Catch::Matchers::Equals(std::vector<int> { 0, 1, 2, 3 }));
+
+    // Removing class 2 removes its connexion to class 0
+    Layout before_removal = Layout::parse("2\n0 2 0 0 1 0\n1 2 2 1 0 3 1 1\n");
+    Layout removed = Layout::parse("2\n0 2 0 0 1 0\n1 1 3 1 1\n");
+    REQUIRE_THAT(warm_start(removed, before_removal), Catch::Matchers::Equals(std::vector<int> { 0, 1 }));
+}
+
+TEST_CASE("Indexed intersections") {
+    TestRng rng { 1 };
+
+    PositionTable positions;
+    for (auto& pos : positions) {
+        pos = SmallPoint { static_cast<uint8_t>(rng() % 12), static_cast<uint8_t>(rng() % 100) };
+    }
+
+    for (int size = 0; size < 100; ++size) {
+        std::vector<IndexedIntersection> ids(size);
+        std::vector<uint8_t> points;
+
+        for (auto& inter : ids) {
+            inter = IndexedIntersection { static_cast<ClassID>(rng()), static_cast<ClassID>(rng()),
+                                          static_cast<ClassID>(rng()), static_cast<ClassID>(rng()) };
+
+            for (ClassID id : { inter.a, inter.b, inter.c, inter.d }) {
+                points.push_back(positions[id].x);
+                points.push_back(positions[id].y);
+            }
+        }
+
+        auto expected = count_intersections<false>(points);
+
+        REQUIRE(count_intersections_indexed<false>(ids, positions) == expected);
+        REQUIRE(count_intersections_indexed<true>(ids, positions) == expected);
+    }
+
+    // Both storages agree while swapping
+    Layout points_layout = sample_layout();
+    Layout ids_layout = points_layout;
+    ids_layout.set_intersection_storage(IntersectionStorage::ClassIDs);
+
+    REQUIRE(ids_layout.get_indexed_intersections().size() == points_layout.get_possible_intersections().size());
+
+    for (int i = 0; i < 200; ++i) {
+        int term_i = rng() % 3;
+        const auto& term = points_layout.get_terms()[term_i];
+        ClassID a = term[rng() % term.size()], b = term[rng() % term.size()];
+
+        points_layout.swap_nodes(points_layout.get_class_mut(a), points_layout.get_class_mut(b));
+        ids_layout.swap_nodes(ids_layout.get_class_mut(a), ids_layout.get_class_mut(b));
+
+        REQUIRE(points_layout.count_crossings() == ids_layout.count_crossings());
+    }
+
+    // A corequisite (3 -> 1, both in term 1) lies along its term, where 0 -> 4 passes through it
+    Layout corequisite = Layout::parse("3\n0 1 0 0\n1 2 1 0 3 1 1\n2 2 5 0 4 1 0\n");
+
+    std::vector<Connexion> connexions;
+    corequisite.for_each_connexion([&] (const Connexion& c) {
+        connexions.push_back(c);
+    });
+
+    IntersectionCounters expected;
+    for (size_t i = 0; i < connexions.size(); ++i) {
+        for (size_t j = i + 1; j < connexions.size(); ++j) {
+            auto [a, b] = connexions[i];
+            auto [c, d] = connexions[j];
+            // Connexions sharing a node are left out, as Layout does
+            if (a.asU16() != c.asU16() && a.asU16() != d.asU16() && b.asU16() != c.asU16() && b.asU16() != d.asU16()) {
+                expected += intersects(a.point(), b.point(), c.point(), d.point());
+            }
+        }
+    }
+
+    REQUIRE(expected == IntersectionCounters { 1, 1 });
+    REQUIRE(corequisite.count_crossings() == expected);
+}
+
+TEST_CASE("Crossing bitsets") {
+    TestRng rng { 7 };
+
+    // Random layouts with connexions between adjacent terms only. The last few have two terms wide enough for
+    // neighbours to span several words
+    for (int trial = 0; trial < 24; ++trial) {
+        bool wide = trial >= 20;
+        int term_count = wide ? 2 : 2 + rng() % 4;
+        Layout layout = random_layout(rng, term_count, wide ? 120 : 12, wide ? 30 : 4, true);
+        CrossingBitsets bitsets { layout };
+
+        REQUIRE(bitsets.count() == layout.count_crossings().proper);
+
+        for (int i = 0; i < 50; ++i) {
+            int term_i = rng() % term_count;
+            const auto& term = layout.get_terms()[term_i];
+            ClassID a = term[rng() % term.size()], b = term[rng() % term.size()];
+
+            auto& node_a = layout.get_class_mut(a);
+            auto& node_b = layout.get_class_mut(b);
+
+            int expected = bitsets.count() + bitsets.swap_delta(term_i, node_a.order, node_b.order);
+            bitsets.swap(term_i, node_a.order, node_b.order);
+            layout.swap_nodes(node_a, node_b);
+
+            REQUIRE(bitsets.count() == expected);
+            REQUIRE(bitsets.count() == layout.count_crossings().proper);
+        }
+    }
+}
+
+TEST_CASE("Waypoints") {
+    // 0 -> 3 skips term 1, where 2 (requiring 1) sits in the way
+    std::istringstream graph {
+        "3\n"
+        "0 2 0 0 1 0\n"
+        "1 1 2 1 1\n"
+        "2 1 3 1 0\n"
+    };
+    Layout layout = Layout::read(graph);
+
+    // The long edge runs through class 2, which only counts as touching
+    REQUIRE(layout.count_crossings() == IntersectionCounters { 0, 1 });
+
+    Layout routed = layout.with_waypoints();
+    REQUIRE(routed.get_terms()[1].size() == 2);
+
+    ClassID waypoint = routed.get_class(3).prereqs[0];
+    REQUIRE(routed.is_waypoint(waypoint));
+    REQUIRE_FALSE(routed.is_waypoint(2));
+    REQUIRE(routed.get_class(waypoint).prereqs[0] == 0);
+
+    // Placed after class 2, so 0 -> waypoint crosses 1 -> 2
+    REQUIRE(routed.get_class(waypoint).order == 1);
+    REQUIRE(routed.count_crossings() == IntersectionCounters { 1, 1 });
+
+    routed.for_each_connexion([&] (const Connexion& c) {
+        REQUIRE(std::abs(c.pt1.x - c.pt2.x) == 1);
+    });
+    REQUIRE(CrossingBitsets { routed }.count() == 1);
+
+    Optimizer optimizer { routed };
+    const auto& best = optimizer.optimize();
+    REQUIRE(best.count_crossings() == IntersectionCounters { 0, 0 });
+
+    Layout restored = best.without_waypoints();
+    REQUIRE(restored.is_compatible_with(layout));
+    REQUIRE(restored.get_class(3).prereqs[0] == 0);
+    REQUIRE_FALSE(restored.is_waypoint(waypoint));
+    REQUIRE(restored.get_terms()[1].size() == 1);
+    REQUIRE(restored.get_class(2).order == 0);
+
+    // An edge over two terms gets a chain of two waypoints
+    std::istringstream longer {
+        "4\n"
+        "0 1 0 0\n"
+        "1 1 1 0\n"
+        "2 1 2 0\n"
+        "3 1 3 1 0\n"
+    };
+    Layout chained = Layout::read(longer).with_waypoints();
+    int connexions = 0;
+    chained.for_each_connexion([&] (const Connexion& c) {
+        REQUIRE(std::abs(c.pt1.x - c.pt2.x) == 1);
+        connexions++;
+    });
+    REQUIRE(connexions == 3);
+    REQUIRE(chained.without_waypoints().get_class(3).prereqs[0] == 0);
+
+    // Class 5 requires 0, which isn't in the layout; a waypoint taking ID 0 would give it a fake edge
+    Layout dangling = Layout::parse("3\n0 1 1 0\n1 1 5 1 0\n2 1 3 1 1\n");
+    Layout dangling_routed = dangling.with_waypoints();
+    connexions = 0;
+    dangling_routed.for_each_connexion([&] (const Connexion&) {
+        connexions++;
+    });
+    REQUIRE(connexions == 2);
+    REQUIRE_FALSE(dangling_routed.is_waypoint(0));
+    REQUIRE(dangling_routed.without_waypoints().get_class(5).prereqs[0] == 0);
+}
+
+TEST_CASE("Connected components") {
+    // Two X shapes sharing nothing, interleaved, plus an isolated class
+    std::istringstream graph {
+        "2\n"
+        "0 5 0 0 10 0 1 0 11 0 20 0\n"
+        "1 4 2 2 1 0 12 2 11 10 3 1 0 13 1 10\n"
+    };
+
+    Layout layout = Layout::read(graph);
+    auto components = layout.connected_components();
+
+    REQUIRE(components.size() == 3);
+    REQUIRE_THAT(components[0], Catch::Matchers::Equals(std::vector<ClassID> { 0, 1, 2, 3 }));
+    REQUIRE_THAT(components[1], Catch::Matchers::Equals(std::vector<ClassID> { 10, 11, 12, 13 }));
+    REQUIRE_THAT(components[2], Catch::Matchers::Equals(std::vector<ClassID> { 20 }));
+
+    Layout sub = layout.sub_layout(components[1]);
+    REQUIRE_THAT(sub.ordered_term(0), Catch::Matchers::Equals(std::vector<ClassID> { 10, 11 }));
+    REQUIRE(sub.count_crossings() == IntersectionCounters { 1, 1 });
+
+    Layout best = optimize_components(layout);
+
+    REQUIRE(best.is_compatible_with(layout));
+    REQUIRE(best.count_crossings() == IntersectionCounters { 0, 0 });
+}
+
+TEST_CASE("Tabu search") {
+    Layout layout = sample_layout();
+    layout.shuffle();
+
+    TabuSearch search { layout, TabuOptions { .iterations = 200 } };
+    Layout best = search.optimize();
+
+    REQUIRE(best.is_compatible_with(layout));
+    REQUIRE(best.count_crossings() == search.get_best_score());
+    REQUIRE_FALSE(layout.count_crossings() < search.get_best_score());
+
+    // The small graph can be drawn without proper crossings
+    REQUIRE(search.get_best_score().proper == 0);
+
+    // Cached deltas, edge length included, stay in step with the layout
+    TestRng rng { 5 };
+    for (int trial = 0; trial < 100; ++trial) {
+        Layout random = random_layout(rng, 3 + rng() % 3, 8, 5, false);
+        random.shuffle();
+
+        TabuOptions options { .iterations = 100 };
+        options.objective.mode = Objective::Mode::Weighted;
+        options.objective.length_weight = 1;
+
+        TabuSearch weighted { random, options };
+        Layout result = weighted.optimize();
+
+        REQUIRE(weighted.get_best_value() == result.evaluate());
+    }
+
+    // Only the active terms are reordered
+    TabuSearch restricted { layout, TabuOptions { .iterations = 200, .active_terms = std::vector { 1 } } };
+    Layout partial = restricted.optimize();
+
+    REQUIRE(partial.get_terms()[0] == layout.get_terms()[0]);
+    REQUIRE(partial.get_terms()[2] == layout.get_terms()[2]);
+    REQUIRE(restricted.get_best_value() == partial.evaluate());
+}
+
+TEST_CASE("Edge length") {
+    TestRng rng { 3 };
+
+    for (int size = 0; size < 100; ++size) {
+        std::vector<Connexion> connexions(size);
+        int expected = 0;
+
+        for (auto& c : connexions) {
+            c = Connexion { SmallPoint { static_cast<uint8_t>(rng() % 12), static_cast<uint8_t>(rng()) },
+                            SmallPoint { static_cast<uint8_t>(rng() % 12), static_cast<uint8_t>(rng()) } };
+            expected += std::abs(c.pt1.y - c.pt2.y);
+        }
+
+        REQUIRE(total_edge_length<false>(connexions) == expected);
+        REQUIRE(total_edge_length<true>(connexions) == expected);
+    }
+
+    Layout points_layout = sample_layout();
+    REQUIRE(points_layout.edge_length() == (3 + 0) + 0 + (0 + 2) + 0 + (0 + 3) + 0 + (0 + 2));
+
+    Layout ids_layout = points_layout;
+    ids_layout.set_intersection_storage(IntersectionStorage::ClassIDs);
+
+    for (int i = 0; i < 200; ++i) {
+        int term_i = rng() % 3;
+        const auto& term = points_layout.get_terms()[term_i];
+        ClassID a = term[rng() % term.size()], b = term[rng() % term.size()];
+
+        points_layout.swap_nodes(points_layout.get_class_mut(a), points_layout.get_class_mut(b));
+        ids_layout.swap_nodes(ids_layout.get_class_mut(a), ids_layout.get_class_mut(b));
+
+        Layout fresh = points_layout;
+        fresh.compute_possible_intersections();
+
+        REQUIRE(points_layout.evaluate() == fresh.evaluate());
+        REQUIRE(ids_layout.evaluate() == fresh.evaluate());
+    }
+
+    // Weighted objectives trade crossings for length
+    Objective lexicographic, weighted { .mode = Objective::Mode::Weighted, .length_weight = 1 };
+    ObjectiveValue crossing { { 1, 1 }, 0 }, long_edges { { 0, 0 }, 5 };
+
+    REQUIRE(lexicographic.better(long_edges, crossing));
+    REQUIRE(weighted.better(crossing, long_edges));
+}
+
+TEST_CASE("Deadlines and checkpoints") {
+    REQUIRE_FALSE(Deadline {}.expired());
+
+    auto deadline = Deadline::after(std::chrono::milliseconds { 0 });
+    bool expired = false;
+    for (int i = 0; i < 1000 && !expired; ++i) {
+        expired = deadline.expired();
+    }
+    REQUIRE(expired);
+    REQUIRE(Deadline::after(std::chrono::milliseconds { 0 }).expired_now());
+    REQUIRE_FALSE(Deadline::after(std::chrono::hours { 1 }).expired_now());
+
+    Layout layout = sample_layout();
+    layout.shuffle();
+
+    OptimizerOptions options;
+    options.objective.mode = Objective::Mode::Weighted;  // edge length keeps the search from stopping early
+
+    std::vector<ObjectiveValue> checkpoints;
+    Checkpointer checkpointer { [&] (const Layout& best) {
+        REQUIRE(best.is_compatible_with(layout));
+        checkpoints.push_back(best.evaluate());
+    }, std::chrono::milliseconds { 0 } };
+    options.checkpointer = &checkpointer;
+
+    // Every pass and every restart checkpoints, and checkpoints only ever get better
+    options.restarts = 4;
+    Optimizer optimizer { layout, options };
+    optimizer.optimize();
+
+    REQUIRE(checkpoints.size() > 4);
+    for (size_t i = 1; i < checkpoints.size(); ++i) {
+        REQUIRE_FALSE(options.objective.better(checkpoints[i - 1], checkpoints[i]));
+    }
+
+    // Including single searches, as for a warm start, and each generic and fixed-bucket search
+    for (bool fixed_buckets : { true, false }) {
+        checkpoints.clear();
+        options.restarts = 0;
+        options.fixed_buckets = fixed_buckets;
+        Optimizer { layout, options }.optimize();
+        REQUIRE_FALSE(checkpoints.empty());
+    }
+
+    checkpoints.clear();
+    optimize_components(layout, options);
+    REQUIRE_FALSE(checkpoints.empty());
+
+    // An expired deadline still returns a layout at least as good as the initial one
+    options.deadline = deadline;
+    options.checkpointer = nullptr;
+
+    Optimizer out_of_time { layout, options };
+    const auto& best = out_of_time.optimize();
+
+    REQUIRE(best.is_compatible_with(layout));
+    REQUIRE_FALSE(options.objective.better(layout.evaluate(), out_of_time.get_best_value()));
+
+    // SIGUSR1 requests a checkpoint from every Checkpointer, not just the first to notice
+    auto never = [] (const Layout&) {};
+    Checkpointer first { never, std::chrono::hours { 1 } }, second { never, std::chrono::hours { 1 } };
+    REQUIRE_FALSE(first.due());
+
+    install_checkpoint_signal();
+    std::raise(SIGUSR1);
+
+    REQUIRE(first.due());
+    first.checkpoint(layout);
+    REQUIRE_FALSE(first.due());
+    REQUIRE(second.due());
+}
+
+TEST_CASE("Kernel tuning") {
+    using namespace Catch::Matchers;
+
+    KernelTuning saved = kernel_tuning;
+
+    // Every variant must agree with the scalar kernels, whichever sizes they're picked for
+    for (size_t min : { (size_t)0, (size_t)16, (size_t)SIZE_MAX }) {
+        kernel_tuning = KernelTuning { min, min, min };
+
+        std::vector<uint16_t> k3, k4;
+        for (int i = 0; i < 409; ++i) {
+            k3.resize(i);
+            for (int j = 0; j < k3.size(); ++j) {
+                k3[j] = j % 5;
+            }
+            k4 = k3;
+
+            // Start off a 64-byte boundary too, to cover the alignment step on short inputs
+            size_t offset = i % 7;
+            swap_small_points<false>(k3.data() + std::min<size_t>(offset, i), k3.data() + i, 1, 2);
+            swap_small_points<true>(k4.data() + std::min<size_t>(offset, i), k4.data() + i, 1, 2);
+
+            REQUIRE_THAT(k3, Equals(k4));
+        }
+
+        std::vector<uint8_t> m(8 * 50);
+        for (int j = 0; j < m.size(); ++j) {
+            m[j] = (j * 37 + 11) % 13;
+        }
+        for (int size = 0; size <= 50; ++size) {
+            auto* begin = (const uint64_t*) m.data();
+            REQUIRE(count_intersections<false>(begin, begin + size) == count_intersections<true>(begin, begin + size));
+        }
+    }
+
+    KernelTuning calibrated = calibrate_kernels();
+
+    std::string filename = "kernel_tuning_test.txt";
+    save_kernel_tuning(calibrated, filename);
+
+    KernelTuning loaded { 1, 2, 3 };
+    REQUIRE(load_kernel_tuning(loaded, filename));
+    REQUIRE(loaded.swap_512_min == calibrated.swap_512_min);
+    REQUIRE(loaded.swap_256_min == calibrated.swap_256_min);
+    REQUIRE(loaded.count_512_min == calibrated.count_512_min);
+    std::remove(filename.c_str());
+
+    REQUIRE_FALSE(load_kernel_tuning(loaded, "does_not_exist.txt"));
+
+    kernel_tuning = saved;
+}
+
+TEST_CASE("Parallel intersection counting") {
+    WorkerPool pool { 4 };
+    REQUIRE(pool.size() == 4);
+
+    std::atomic<int> calls = 0;
+    pool.run([&] (unsigned worker) {
+        calls++;
+
+        // Nested jobs run on the calling worker alone
+        if (worker == 0) {
+            pool.run([&] (unsigned nested) {
+                REQUIRE(nested == 0);
+            });
+        }
+    });
+    REQUIRE(calls == 4);
+
+    TestRng rng { 3 };
+    std::vector<uint8_t> m(8 * 50000);
+    for (auto& coord : m) {
+        coord = rng() % 16;
+    }
+
+    KernelTuning saved = kernel_tuning;
+    kernel_tuning.parallel_count_min = 0;
+
+    // Unaligned starts and ragged ends exercise the head and the last chunk
+    auto* data = (const uint64_t*) m.data();
+    for (size_t offset : { 0, 1, 7 }) {
+        for (size_t size : { (size_t)0, (size_t)5, (size_t)4096, (size_t)4097, (size_t)(50000 - 7) }) {
+            REQUIRE(count_intersections_parallel(data + offset, data + offset + size, &pool)
+                == count_intersections<false>(data + offset, data + offset + size));
+        }
+    }
+
+    kernel_tuning = saved;
+}
+
+TEST_CASE("Fixed layouts") {
+    TestRng rng { 11 };
+
+    // Random layouts with connexions between adjacent terms only, so both buckets get used
+    for (int trial = 0; trial < 20; ++trial) {
+        int term_count = 2 + rng() % 9;
+        Layout layout = random_layout(rng, term_count, 24, 6, true);
+
+        bool fitted = with_fixed_layout(layout, [&] (auto& fixed) {
+            REQUIRE(fixed.evaluate() == layout.evaluate());
+
+            for (int i = 0; i < 50; ++i) {
+                int term_i = rng() % term_count;
+                int a = rng() % fixed.term_size(term_i), b = rng() % fixed.term_size(term_i);
+
+                auto expected = fixed.evaluate() + fixed.swap_delta(term_i, a, b);
+                fixed.swap(term_i, a, b);
+                REQUIRE(fixed.evaluate() == expected);
+            }
+
+            Layout written = layout;
+            fixed.write_orders(written);
+            REQUIRE(written.is_compatible_with(layout));
+            REQUIRE(written.evaluate() == fixed.evaluate());
+        });
+        REQUIRE(fitted);
+    }
+
+    // Connexions skipping a term don't fit any bucket until routed through waypoints
+    std::istringstream graph {
+        "3\n"
+        "0 2 0 0 1 0\n"
+        "1 1 2 1 1\n"
+        "2 1 3 1 0\n"
+    };
+    Layout layout = Layout::read(graph);
+    REQUIRE_FALSE(with_fixed_layout(layout, [] (auto&) {}));
+
+    Layout routed = layout.with_waypoints();
+    REQUIRE(FixedLayout<8, 32>::fits(routed));
+
+    OptimizerOptions generic;
+    generic.fixed_buckets = false;
+
+    Optimizer specialized { routed }, reference { routed, generic };
+    REQUIRE(specialized.optimize().evaluate() == reference.optimize().evaluate());
+    REQUIRE(specialized.get_best_value() == specialized.get_best().evaluate());
+}
+
+TEST_CASE("Text format") {
+    const std::string text =
+        "3\n"
+        "0 2 0 0 1 0\n"
+        "1 1 2 1 1\n"
+        "2 2\n"
+        "  3 2 0 2\r\n"
+        "\t4 0\n";
+
+    Layout layout = Layout::parse(text);
+    REQUIRE(layout.term_count() == 3);
+    REQUIRE(layout.get_terms()[2] == std::vector<uint8_t> { 3, 4 });
+    REQUIRE(layout.get_class(4).order == 1);
+    REQUIRE(layout.get_class(3).prereq_count() == 2);
+    REQUIRE(layout.get_class(3).prereqs[1] == 2);
+
+    std::istringstream in { text };
+    REQUIRE(Layout::read(in).evaluate() == layout.evaluate());
+
+    std::string filename = "layout_text_test.txt";
+    {
+        std::ofstream out { filename };
+        out << text;
+    }
+    REQUIRE(Layout::read_file(filename).evaluate() == layout.evaluate());
+    std::remove(filename.c_str());
+
+    REQUIRE_THROWS_AS(Layout::read_file("does_not_exist.txt"), std::runtime_error);
+
+    auto error_line = [] (const std::string& bad) -> size_t {
+        try {
+            Layout::parse(bad);
+        } catch (const LayoutParseError& error) {
+            return error.line;
+        }
+        return 0;
+    };
+
+    REQUIRE(error_line("") == 1);                          // no term count
+    REQUIRE(error_line("0\n") == 1);                       // no terms
+    REQUIRE(error_line("2\n0 1 0 0\n") == 3);              // truncated
+    REQUIRE(error_line("1\n1 1 0 0\n") == 2);              // wrong term index
+    REQUIRE(error_line("1\n0 2 0 0\n0 0\n") == 3);         // duplicate class
+    REQUIRE(error_line("1\n0 1 254 0\n") == 2);            // class ID out of range
+    REQUIRE(error_line("1\n0 1 5 1 5\n") == 2);            // requires itself
+    REQUIRE(error_line("1\n0 1 5 9 0 1 2 3 4 6 7 8 9\n") == 2);  // too many prereqs
+    REQUIRE(error_line("1\n0 1 x 0\n") == 2);              // not a number
+}
+
+TEST_CASE("Reusing layout buffers") {
+    const std::string json = R"({
+  "curriculum_terms": [
+    { "curriculum_items": [
+        { "curriculum_requisites": [], "id": 1 },
+        { "curriculum_requisites": [], "id": 2 }
+    ] },
+    { "curriculum_items": [
+        { "curriculum_requisites": [ { "source_id": 2, "target_id": 3 } ], "id": 3 },
+        { "curriculum_requisites": [ { "source_id": 1, "target_id": 4 } ], "id": 4 }
+    ] }
+  ]
+})";
+
+    LayoutIO io;
+    std::istringstream first_in { json };
+    io.read_json(first_in);
+
+    Layout first = io.get_layout();
+    const auto* buffer = io.get_layout().get_possible_intersections().data();
+
+    // Reads alternate between two sets of buffers, so the third fits in those of the first
+    for (int read = 0; read < 2; ++read) {
+        std::istringstream again_in { json };
+        io.read_json(again_in);
+    }
+
+    REQUIRE(io.get_layout().get_possible_intersections().data() == buffer);
+    REQUIRE(io.get_layout().evaluate() == first.evaluate());
+    REQUIRE(io.get_layout().is_compatible_with(first));
+
+    std::ostringstream same;
+    io.write_new_layout(first, same);
+    REQUIRE(same.str() == json);
+
+    std::istringstream invalid { "{ \"curriculum_terms\": [ " };
+    REQUIRE_THROWS_AS(io.read_json(invalid), std::runtime_error);
+
+    std::istringstream bad_id { R"({ "curriculum_terms": [ { "curriculum_items": [ { "id": "1", "curriculum_requisites": [] } ] } ] })" };
+    REQUIRE_THROWS_AS(io.read_json(bad_id), std::runtime_error);
+
+    // Failing past the first term, after some of it was parsed
+    std::istringstream duplicate { R"({ "curriculum_terms": [
+    { "curriculum_items": [ { "curriculum_requisites": [], "id": 7 } ] },
+    { "curriculum_items": [ { "curriculum_requisites": [], "id": 7 } ] }
+  ] })" };
+    REQUIRE_THROWS_AS(io.read_json(duplicate), std::runtime_error);
+
+    REQUIRE_THROWS_AS(io.read_json("no_such_file.json"), std::runtime_error);
+
+    // None of which touched the last good input
+    REQUIRE(io.get_layout().is_compatible_with(first));
+    REQUIRE(io.get_layout().evaluate() == first.evaluate());
+
+    std::ostringstream after_failures;
+    io.write_new_layout(first, after_failures);
+    REQUIRE(after_failures.str() == json);
+
+    // Text layouts likewise
+    std::string text =
+        "2\n"
+        "0 2 0 0 1 0\n"
+        "1 2 2 1 1 3 1 0\n";
+
+    Layout layout = Layout::parse(text);
+    const auto* intersections = layout.get_possible_intersections().data();
+    const auto* term = layout.get_terms()[1].data();
+
+    layout.shuffle();
+    layout.reload(text);
+
+    REQUIRE(layout.get_possible_intersections().data() == intersections);
+    REQUIRE(layout.get_terms()[1].data() == term);
+    REQUIRE(layout.evaluate() == Layout::parse(text).evaluate());
+}